@@ -8,7 +8,8 @@
 // Interface:
 // * To get a buffer for a particular disk block, call bread.
 // * After changing buffer data, call bwrite to write it to disk.
-// * When done with the buffer, call brelse.
+// * When done with the buffer, call brelse, or brelse_cold if
+//     it held file data, which the page cache keeps instead.
 // * Do not use the buffer after calling brelse.
 // * Only one process at a time can use a buffer,
 //     so do not keep them longer than necessary.
@@ -21,6 +22,7 @@
 #include "defs.h"
 #include "fs.h"
 #include "buf.h"
+#include "memstat.h"
 
 struct
 {
@@ -33,6 +35,13 @@ struct
     struct buf head;
 } bcache;
 
+// Fill in the buffer cache's field of st. The buffers are
+// part of the kernel image, not the allocator's.
+void bio_memstat(struct memstat* st)
+{
+    st->nbcache = sizeof(bcache.buf) / PGSIZE;
+}
+
 void binit(void)
 {
     struct buf* b;
@@ -133,6 +142,29 @@ void brelse(struct buf* b)
     release(&bcache.lock);
 }
 
+// Release a locked buffer that is unlikely to be wanted again.
+// Move it to the tail of the list, so that it is the first to be
+// recycled and doesn't push metadata out of the cache.
+void brelse_cold(struct buf* b)
+{
+    if (!holdingsleep(&b->lock))
+        panic("brelse_cold");
+
+    releasesleep(&b->lock);
+
+    acquire(&bcache.lock);
+    b->refcnt--;
+    if (b->refcnt == 0) {
+        b->next->prev = b->prev;
+        b->prev->next = b->next;
+        b->prev = bcache.head.prev;
+        b->next = &bcache.head;
+        bcache.head.prev->next = b;
+        bcache.head.prev = b;
+    }
+    release(&bcache.lock);
+}
+
 void bpin(struct buf* b)
 {
     acquire(&bcache.lock);
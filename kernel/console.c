@@ -92,7 +92,8 @@ int console_read(int user_dst, uint64_t dst, int n)
                 release(&cons.lock);
                 return -1;
             }
-            sleep(&cons.r, &cons.lock);
+            sched_io_boost(); // waiting for a keystroke: interactive
+            sleep_user(&cons.r, &cons.lock, dst, user_dst ? n : 0);
         }
 
         c = cons.buf[cons.r++ % INPUT_BUF_SIZE];
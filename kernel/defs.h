@@ -2,17 +2,24 @@ struct buf;
 struct context;
 struct file;
 struct inode;
+struct kmem_cache;
+struct memstat;
 struct pipe;
+struct shm;
 struct proc;
+struct pstat;
 struct spinlock;
 struct sleeplock;
 struct stat;
+struct vma;
 struct superblock;
 
 // bio.c
 void binit(void);
+void bio_memstat(struct memstat*);
 struct buf* bread(uint_t, uint_t);
 void brelse(struct buf*);
+void brelse_cold(struct buf*);
 void bwrite(struct buf*);
 void bpin(struct buf*);
 void bunpin(struct buf*);
@@ -24,6 +31,13 @@ void cons_putc(int);
 
 // exec.c
 int exec(char*, char**);
+int exec_proc(struct proc*, char*, char**);
+
+// fdt.c
+extern uint64_t dtb;
+void fdt_init(void);
+char* fdt_bootargs(void);
+char* bootarg(char*, char*, int);
 
 // file.c
 struct file* file_alloc(void);
@@ -50,6 +64,7 @@ int namecmp(const char*, const char*);
 struct inode* namei(char*);
 struct inode* nameiparent(char*, char*);
 int readi(struct inode*, int, uint64_t, uint_t, uint_t);
+int readi_nocache(struct inode*, int, uint64_t, uint_t, uint_t);
 void stati(struct inode*, struct stat*);
 int writei(struct inode*, int, uint64_t, uint_t, uint_t);
 void itrunc(struct inode*);
@@ -59,10 +74,25 @@ void ramdiskinit(void);
 void ramdiskintr(void);
 void ramdiskrw(struct buf*);
 
+// kbench.c
+void kbench(void);
+
 // k_alloc.c
 void* k_alloc(void);
+void* k_alloc_zeroed(void);
+int k_zero_idle(void);
 void k_free(void*);
+void* k_alloc_order(int);
+void* k_try_order(int);
+void k_free_order(void*, int);
+void k_split(void*, int);
+void k_use(void*, int);
+void k_ref_inc(void*);
+int k_ref_count(void*);
 void k_init(void);
+void k_memstat(struct memstat*);
+uint64_t k_nfree(void);
+int k_reclaim(void);
 
 // log.c
 void initlog(int, struct superblock*);
@@ -70,7 +100,33 @@ void log_write(struct buf*);
 void begin_op(void);
 void end_op(void);
 
+// pcache.c
+void pcache_init(void);
+char* pcache_get(struct inode*, uint_t, int);
+void pcache_write(struct inode*, uint_t, char*, uint_t);
+void pcache_inval(struct inode*);
+int pcache_reclaim(int);
+int pcache_npages(void);
+
+// shm.c
+void shm_init(void);
+struct shm* shm_get(int, uint64_t);
+void shm_dup(struct shm*);
+void shm_put(struct shm*);
+uint64_t shm_size(struct shm*);
+char* shm_page(struct shm*, uint_t);
+
+// swap.c
+void swap_init(void);
+int swap_in(pte_t*);
+int swap_out(int);
+int swap_reclaim(void);
+void swap_dup(int);
+void swap_free(int);
+void swap_memstat(struct memstat*);
+
 // pipe.c
+void pipe_init(void);
 int pipealloc(struct file**, struct file**);
 void pipeclose(struct pipe*, int);
 int piperead(struct pipe*, uint64_t, int);
@@ -85,11 +141,14 @@ void printf_init(void);
 int cpu_id(void);
 void exit(int);
 int fork(void);
+int spawn(char*, char**, struct file**);
 int growproc(int);
 void proc_map_stacks(pagetable_t);
 pagetable_t proc_pagetable(struct proc*);
 void proc_free_pagetable(pagetable_t, uint64_t);
 int kill(int);
+int setnice(int, int);
+int getnice(int, int*);
 int killed(struct proc*);
 void setkilled(struct proc*);
 struct cpu* my_cpu(void);
@@ -99,6 +158,8 @@ void proc_init(void);
 void scheduler(void) __attribute__((noreturn));
 void sched(void);
 void sleep(void*, struct spinlock*);
+void sleep_user(void*, struct spinlock*, uint64_t, uint64_t);
+void waitq_init(void);
 void user_init(void);
 int wait(uint64_t);
 void wakeup(void*);
@@ -106,6 +167,18 @@ void yield(void);
 int either_copyout(int user_dst, uint64_t dst, void* src, uint64_t len);
 int either_copyin(void* dst, int user_src, uint64_t src, uint64_t len);
 void procdump(void);
+int proc_stat(uint64_t, int);
+
+// sched.c
+void runq_init(void);
+void runq_add(struct proc*);
+struct proc* runq_take(int);
+int proc_prio(struct proc*);
+int sched_preempt(int);
+void sched_charge(struct proc*);
+void sched_run(struct proc*);
+void sched_idle(void);
+void sched_io_boost(void);
 
 // swtch.S
 void swtch(struct context*, struct context*);
@@ -118,6 +191,11 @@ void release(struct spinlock*);
 void push_off(void);
 void pop_off(void);
 
+// slab.c
+void kmem_cache_init(struct kmem_cache*, char*, uint_t);
+void* kmem_cache_alloc(struct kmem_cache*);
+void kmem_cache_free(struct kmem_cache*, void*);
+
 // sleeplock.c
 void acquiresleep(struct sleeplock*);
 void releasesleep(struct sleeplock*);
@@ -125,6 +203,7 @@ int holdingsleep(struct sleeplock*);
 void initsleeplock(struct sleeplock*, char*);
 
 // string.c
+extern int rvv;
 int memcmp(const void*, const void*, uint_t);
 void* memmove(void*, const void*, uint_t);
 void* memset(void*, int, uint_t);
@@ -147,6 +226,10 @@ void trapinit(void);
 void trapinithart(void);
 extern struct spinlock tickslock;
 void usertrapret(void);
+void ticks_update(void);
+void timer_wake_at(uint_t);
+void timer_idle(void);
+void timer_busy(void);
 
 // uart.c
 void uart_init(void);
@@ -165,15 +248,47 @@ void uvm_first(pagetable_t, uchar_t*, uint_t);
 uint64_t uvm_alloc(pagetable_t, uint64_t, uint64_t, int);
 uint64_t uvmdealloc(pagetable_t, uint64_t, uint64_t);
 int uvmcopy(pagetable_t, pagetable_t, uint64_t);
+int uvmcopy_range(pagetable_t, pagetable_t, uint64_t, uint64_t, int);
+uint64_t uvm_fault(pagetable_t, uint64_t, uint64_t, int);
+// uvm_fault()'s and vma_fault()'s access: what the faulting
+// instruction did, and the PTE bit that allows it.
+#define FAULT_LOAD 0
+#define FAULT_STORE 1
+#define FAULT_FETCH 2
+#define FAULT_PERM(access) ((access) == FAULT_STORE ? PTE_W : (access) == FAULT_FETCH ? PTE_X : PTE_R)
+int uvm_megapage(pagetable_t, uint64_t);
 void uvmfree(pagetable_t, uint64_t);
-void uvm_unmap(pagetable_t, uint64_t, uint64_t, int);
+int uvm_unmap(pagetable_t, uint64_t, uint64_t, int);
+#define UVM_TEARDOWN 2 // uvm_unmap()'s do_free for a dying page table
 void uvmclear(pagetable_t, uint64_t);
 pte_t* walk(pagetable_t, uint64_t, int);
+pte_t* walk_level(pagetable_t, uint64_t, int, int);
+void freewalk(pagetable_t);
+void uvm_stat(pagetable_t, struct pstat*);
+int demote(pte_t*);
+uint64_t asid_satp(struct proc*);
+void tlb_invalidate(struct proc*, uint64_t, uint64_t);
+void tlb_flush_page(struct proc*, uint64_t);
+int kvm_share(pagetable_t);
+void kvm_unshare(pagetable_t);
+void kvm_switch(struct proc*);
 uint64_t walk_addr(pagetable_t, uint64_t);
 int copyout(pagetable_t, uint64_t, char*, uint64_t);
 int copyin(pagetable_t, char*, uint64_t, uint64_t);
 int copyinstr(pagetable_t, char*, uint64_t, uint64_t);
 
+// vma.c
+uint64_t vma_fault(struct proc*, uint64_t, int);
+void vma_prefault(struct proc*, uint64_t, uint64_t);
+int vma_populate_shared(struct proc*);
+int vma_copy(struct proc*, struct proc*);
+void vma_trim(struct proc*, uint64_t);
+uint64_t vma_floor(struct proc*);
+uint64_t vma_mmap(struct proc*, uint64_t, int, int, struct inode*, struct shm*, uint_t);
+int vma_munmap(struct proc*, uint64_t, uint64_t);
+void vma_munmap_all(struct proc*);
+void vma_put(struct vma*);
+
 // plic.c
 void plicinit(void);
 void plicinithart(void);
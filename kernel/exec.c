@@ -6,6 +6,7 @@
 #include "proc.h"
 #include "defs.h"
 #include "elf.h"
+#include "mman.h"
 
 static int loadseg(pde_t*, uint64_t, struct inode*, uint_t, uint_t);
 
@@ -20,6 +21,14 @@ int flags2perm(int flags)
 }
 
 int exec(char* path, char** argv)
+{
+    return exec_proc(my_proc(), path, argv);
+}
+
+// Replace p's user image with the program at path, run with
+// arguments argv. p is the current process (exec()), or a new
+// one that isn't running yet (spawn()). Returns argc, or -1.
+int exec_proc(struct proc* p, char* path, char** argv)
 {
     char *s, *last;
     int i, off;
@@ -27,8 +36,11 @@ int exec(char* path, char** argv)
     struct elfhdr elf;
     struct inode* ip;
     struct proghdr ph;
+    struct vma vmas[NVMA];
+    int nvma = 0;
     pagetable_t pagetable = 0, oldpagetable;
-    struct proc* p = my_proc();
+
+    memset(vmas, 0, sizeof(vmas));
 
     begin_op();
 
@@ -48,7 +60,9 @@ int exec(char* path, char** argv)
     if ((pagetable = proc_pagetable(p)) == 0)
         goto bad;
 
-    // Load program into memory.
+    // Map the program. Segments whose file offset is page-aligned,
+    // as the linker lays them out, become demand-paged mappings
+    // of ip (see vma.c); anything else is read in now.
     for (i = 0, off = elf.phoff; i < elf.phnum; i++, off += sizeof(ph)) {
         if (readi(ip, 0, (uint64_t)&ph, off, sizeof(ph)) != sizeof(ph))
             goto bad;
@@ -60,6 +74,20 @@ int exec(char* path, char** argv)
             goto bad;
         if (ph.vaddr % PGSIZE != 0)
             goto bad;
+        if (ph.vaddr + ph.memsz > HEAPTOP)
+            goto bad;
+        if (ph.off % PGSIZE == 0 && ph.vaddr >= PGROUNDUP(sz) && nvma < NVMA) {
+            struct vma* v = &vmas[nvma++];
+            v->start = ph.vaddr;
+            v->end = PGROUNDUP(ph.vaddr + ph.memsz);
+            v->perm = PTE_R | flags2perm(ph.flags);
+            v->flags = MAP_PRIVATE;
+            v->ip = ip; // referenced below, once nothing can fail
+            v->off = ph.off;
+            v->filesz = ph.filesz;
+            sz = ph.vaddr + ph.memsz;
+            continue;
+        }
         uint64_t sz1;
         if ((sz1 = uvm_alloc(pagetable, sz, ph.vaddr + ph.memsz, flags2perm(ph.flags))) == 0)
             goto bad;
@@ -67,17 +95,20 @@ int exec(char* path, char** argv)
         if (loadseg(pagetable, ph.vaddr, ip, ph.off, ph.filesz) < 0)
             goto bad;
     }
+    for (i = 0; i < nvma; i++)
+        idup(vmas[i].ip);
     iunlockput(ip);
     end_op();
     ip = 0;
 
-    p = my_proc();
     uint64_t oldsz = p->sz;
 
     // Allocate some pages at the next page boundary.
     // Make the first inaccessible as a stack guard.
     // Use the rest as the user stack.
     sz = PGROUNDUP(sz);
+    if (sz + (USERSTACK + 1) * PGSIZE > HEAPTOP)
+        goto bad;
     uint64_t sz1;
     if ((sz1 = uvm_alloc(pagetable, sz, sz + (USERSTACK + 1) * PGSIZE, PTE_W)) == 0)
         goto bad;
@@ -120,12 +151,20 @@ int exec(char* path, char** argv)
     safestrcpy(p->name, last, sizeof(p->name));
 
     // Commit to the user image.
+    vma_munmap_all(p);
+    if (p == my_proc())
+        kvm_switch(0); // we may be running on the old one
     oldpagetable = p->pagetable;
     p->pagetable = pagetable;
+    tlb_invalidate(p, 0, -1); // entries of the old page table
     p->sz = sz;
     p->trap_frame->epc = elf.entry; // initial program counter = main
     p->trap_frame->sp = sp; // initial stack pointer
     proc_free_pagetable(oldpagetable, oldsz);
+    begin_op();
+    vma_put(p->vmas);
+    end_op();
+    memmove(p->vmas, vmas, sizeof(vmas));
 
     return argc; // this ends up in a0, the first argument to main(argc, argv)
 
@@ -135,6 +174,10 @@ bad:
     if (ip) {
         iunlockput(ip);
         end_op();
+    } else if (nvma > 0) {
+        begin_op();
+        vma_put(vmas);
+        end_op();
     }
     return -1;
 }
@@ -0,0 +1,110 @@
+//
+// Boot arguments, from the device tree.
+//
+// qemu starts each hart with a1 holding the address of a
+// flattened device tree describing the machine (entry.S saves
+// it in dtb). The kernel wants just one thing from it: the
+// bootargs property of the /chosen node, which qemu fills in
+// from -append, so that options like sched=fair can be picked
+// at boot without rebuilding the kernel. The tree lies in the
+// memory k_init() hands out, so main() calls fdt_init() to copy
+// the string before that.
+//
+
+#include "types.h"
+#include "param.h"
+#include "riscv.h"
+#include "defs.h"
+
+#define FDT_MAGIC 0xd00dfeed
+
+// tokens of the structure block.
+#define FDT_BEGIN_NODE 1 // followed by the node's name
+#define FDT_END_NODE 2
+#define FDT_PROP 3 // followed by length, name offset, value
+#define FDT_NOP 4
+#define FDT_END 9
+
+uint64_t dtb; // set by entry.S
+
+static char bootargs[128];
+
+// The tree is big-endian.
+static uint_t
+be32(char* p)
+{
+    uchar_t* b = (uchar_t*)p;
+    return ((uint_t)b[0] << 24) | ((uint_t)b[1] << 16) | ((uint_t)b[2] << 8) | b[3];
+}
+
+// Copy the boot arguments out of the device tree at dtb.
+void fdt_init(void)
+{
+    char* fdt = (char*)dtb;
+    char *p, *end, *strings;
+    int depth = 0, chosen = 0;
+    uint_t len;
+
+    if (fdt == 0 || be32(fdt) != FDT_MAGIC)
+        return;
+    p = fdt + be32(fdt + 8); // off_dt_struct
+    strings = fdt + be32(fdt + 12); // off_dt_strings
+    end = p + be32(fdt + 36); // size_dt_struct
+
+    while (p < end) {
+        uint_t tok = be32(p);
+        p += 4;
+        switch (tok) {
+        case FDT_BEGIN_NODE:
+            // the root is at depth 1, and has no name.
+            depth++;
+            chosen = depth == 2 && strncmp(p, "chosen", 7) == 0;
+            p += (strlen(p) + 1 + 3) & ~3;
+            break;
+        case FDT_END_NODE:
+            depth--;
+            chosen = 0;
+            break;
+        case FDT_PROP:
+            len = be32(p);
+            if (chosen && strncmp(strings + be32(p + 4), "bootargs", 9) == 0)
+                safestrcpy(bootargs, p + 8, len < sizeof(bootargs) ? len : sizeof(bootargs));
+            p += 8 + ((len + 3) & ~3);
+            break;
+        case FDT_NOP:
+            break;
+        default: // FDT_END
+            return;
+        }
+    }
+}
+
+// The boot arguments, "" if none.
+char* fdt_bootargs(void)
+{
+    return bootargs;
+}
+
+// If the boot arguments have a word name=value, copy value into
+// buf, of n bytes, and return buf; else return 0.
+char* bootarg(char* name, char* buf, int n)
+{
+    int len = strlen(name);
+    char* p = bootargs;
+
+    while (*p) {
+        while (*p == ' ')
+            p++;
+        char* w = p;
+        while (*p && *p != ' ')
+            p++;
+        if (p - w > len && strncmp(w, name, len) == 0 && w[len] == '=') {
+            w += len + 1;
+            if (p - w < n)
+                n = p - w + 1;
+            safestrcpy(buf, w, n);
+            return buf;
+        }
+    }
+    return 0;
+}
@@ -12,33 +12,35 @@
 #include "file.h"
 #include "stat.h"
 #include "proc.h"
+#include "slab.h"
 
 struct devsw devsw[NDEV];
+
+// open files come from a slab cache, so there is no fixed
+// limit on them; ftable.lock protects every f->ref.
 struct {
     struct spinlock lock;
-    struct file file[NFILE]; // 至多有 NFILE 个文件
 } ftable;
 
+static struct kmem_cache file_cache;
+
 void file_init(void)
 {
     init_lock(&ftable.lock, "ftable");
+    kmem_cache_init(&file_cache, "file", sizeof(struct file));
 }
 
 // Allocate a file structure.
+// Returns 0 if out of memory.
 struct file* file_alloc(void)
 {
     struct file* f;
 
-    acquire(&ftable.lock);
-    for (f = ftable.file; f < ftable.file + NFILE; f++) {
-        if (f->ref == 0) {
-            f->ref = 1;
-            release(&ftable.lock);
-            return f;
-        }
-    }
-    release(&ftable.lock);
-    return 0;
+    if ((f = kmem_cache_alloc(&file_cache)) == 0)
+        return 0;
+    memset(f, 0, sizeof(*f));
+    f->ref = 1;
+    return f;
 }
 
 // Increment ref count for file f.
@@ -66,12 +68,13 @@ void fileclose(struct file* f)
         return;
     }
     ff = *f;
-    f->ref = 0;
-    f->type = FD_NONE;
     release(&ftable.lock);
+    kmem_cache_free(&file_cache, f);
 
     if (ff.type == FD_PIPE) {
         pipeclose(ff.pipe, ff.writable);
+    } else if (ff.type == FD_SHM) {
+        shm_put(ff.shm);
     } else if (ff.type == FD_INODE || ff.type == FD_DEVICE) {
         begin_op();
         iput(ff.ip);
@@ -106,6 +109,11 @@ int fileread(struct file* f, uint64_t addr, int n)
     if (f->readable == 0)
         return -1;
 
+    // read in any file-backed pages of the buffer now: the
+    // copyout()s below may run with locks held.
+    if (n > 0)
+        vma_prefault(my_proc(), addr, n);
+
     if (f->type == FD_PIPE) {
         r = piperead(f->pipe, addr, n);
     } else if (f->type == FD_DEVICE) {
@@ -117,6 +125,8 @@ int fileread(struct file* f, uint64_t addr, int n)
         if ((r = readi(f->ip, 1, addr, f->off, n)) > 0)
             f->off += r;
         iunlock(f->ip);
+    } else if (f->type == FD_SHM) {
+        return -1; // mmap() it
     } else {
         panic("fileread");
     }
@@ -133,6 +143,10 @@ int filewrite(struct file* f, uint64_t addr, int n)
     if (f->writable == 0)
         return -1;
 
+    // as in fileread(), for the copyin()s.
+    if (n > 0)
+        vma_prefault(my_proc(), addr, n);
+
     if (f->type == FD_PIPE) {
         ret = pipewrite(f->pipe, addr, n);
     } else if (f->type == FD_DEVICE) {
@@ -167,6 +181,8 @@ int filewrite(struct file* f, uint64_t addr, int n)
             i += r;
         }
         ret = (i == n ? n : -1);
+    } else if (f->type == FD_SHM) {
+        return -1;
     } else {
         panic("filewrite");
     }
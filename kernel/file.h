@@ -2,11 +2,13 @@ struct file {
     enum { FD_NONE,
         FD_PIPE,
         FD_INODE,
-        FD_DEVICE } type;
+        FD_DEVICE,
+        FD_SHM } type;
     int ref; // reference count
     char readable;
     char writable;
     struct pipe* pipe; // FD_PIPE
+    struct shm* shm; // FD_SHM
     struct inode* ip; // FD_INODE and FD_DEVICE
     uint_t off; // FD_INODE
     short major; // FD_DEVICE
@@ -21,6 +23,10 @@ struct inode {
     uint_t dev; // Device number
     uint_t inum; // Inode number
     int ref; // Reference count
+    struct inode* hnext; // itable hash chain
+    struct inode* lru_next; // itable idle list, when ref == 0
+    struct inode* lru_prev;
+    struct cpage* pages; // cached file pages, under pcache.lock
     struct sleeplock lock; // protects everything below here
     int valid; // inode has been read from disk?
 
@@ -20,6 +20,7 @@
 #include "fs.h"
 #include "buf.h"
 #include "file.h"
+#include "slab.h"
 
 #define min(a, b) ((a) < (b) ? (a) : (b))
 // there should be one superblock per disk device, but we run with
@@ -129,12 +130,16 @@ bfree(int dev, uint_t b)
 //   is non-zero. ialloc() allocates, and iput() frees if
 //   the reference and link counts have fallen to zero.
 //
-// * Referencing in table: an entry in the inode table
-//   is free if ip->ref is zero. Otherwise ip->ref tracks
-//   the number of in-memory pointers to the entry (open
-//   files and current directories). iget() finds or
-//   creates a table entry and increments its ref; iput()
-//   decrements ref.
+// * Referencing in table: in-memory inodes are allocated
+//   from a slab cache and found through a hash table keyed
+//   by (dev, inum). ip->ref tracks the number of in-memory
+//   pointers to the entry (open files and current
+//   directories). iget() finds or creates a table entry and
+//   increments its ref; iput() decrements ref. An entry
+//   whose ref falls to zero stays in the table on an LRU
+//   idle list, so that it can be found again without
+//   reading the disk; at most NINODE idle entries are kept,
+//   older ones go back to the slab cache.
 //
 // * Valid: the information (type, size, &c) in an inode
 //   table entry is only correct when ip->valid is 1.
@@ -165,27 +170,86 @@ bfree(int dev, uint_t b)
 // multi-step atomic operations.
 //
 // The itable.lock spin-lock protects the allocation of itable
-// entries. Since ip->ref indicates whether an entry is free,
-// and ip->dev and ip->inum indicate which i-node an entry
-// holds, one must hold itable.lock while using any of those fields.
+// entries, the hash chains and the idle list. Since ip->ref
+// indicates whether an entry is idle, and ip->dev and ip->inum
+// indicate which i-node an entry holds, one must hold itable.lock
+// while using any of those fields.
 //
 // An ip->lock sleep-lock protects all ip-> fields other than ref,
-// dev, and inum.  One must hold ip->lock in order to
+// dev, inum and the list links.  One must hold ip->lock in order to
 // read or write that inode's ip->valid, ip->size, ip->type, &c.
 
+#define NIHASH 61
+
 struct {
     struct spinlock lock;
-    struct inode inode[NINODE];
+    struct inode* hash[NIHASH]; // all entries, by (dev, inum)
+    struct inode* lru_head; // idle entries, least recently used first
+    struct inode* lru_tail;
+    int nidle;
 } itable;
 
+static struct kmem_cache inode_cache;
+
+#define IHASH(dev, inum) (((dev) * 31 + (inum)) % NIHASH)
+
 void iinit()
 {
-    int i = 0;
-
     init_lock(&itable.lock, "itable");
-    for (i = 0; i < NINODE; i++) {
-        initsleeplock(&itable.inode[i].lock, "inode");
+    kmem_cache_init(&inode_cache, "inode", sizeof(struct inode));
+}
+
+// Append ip to the idle list. Caller must hold itable.lock.
+static void
+idle_append(struct inode* ip)
+{
+    ip->lru_next = 0;
+    ip->lru_prev = itable.lru_tail;
+    if (itable.lru_tail)
+        itable.lru_tail->lru_next = ip;
+    else
+        itable.lru_head = ip;
+    itable.lru_tail = ip;
+    itable.nidle++;
+}
+
+// Take ip off the idle list. Caller must hold itable.lock.
+static void
+idle_remove(struct inode* ip)
+{
+    if (ip->lru_prev)
+        ip->lru_prev->lru_next = ip->lru_next;
+    else
+        itable.lru_head = ip->lru_next;
+    if (ip->lru_next)
+        ip->lru_next->lru_prev = ip->lru_prev;
+    else
+        itable.lru_tail = ip->lru_prev;
+    itable.nidle--;
+}
+
+// Take ip out of its hash chain. Caller must hold itable.lock.
+static void
+hash_remove(struct inode* ip)
+{
+    struct inode** pp = &itable.hash[IHASH(ip->dev, ip->inum)];
+    while (*pp != ip)
+        pp = &(*pp)->hnext;
+    *pp = ip->hnext;
+}
+
+// Detach the least recently used idle entry from the table,
+// for reuse or to be freed. Returns 0 if nothing is idle.
+// Caller must hold itable.lock.
+static struct inode*
+idle_evict(void)
+{
+    struct inode* ip = itable.lru_head;
+    if (ip) {
+        idle_remove(ip);
+        hash_remove(ip);
     }
+    return ip;
 }
 
 static struct inode* iget(uint_t dev, uint_t inum);
@@ -244,31 +308,36 @@ void iupdate(struct inode* ip)
 static struct inode*
 iget(uint_t dev, uint_t inum)
 {
-    struct inode *ip, *empty;
+    struct inode* ip;
 
     acquire(&itable.lock);
 
     // Is the inode already in the table?
-    empty = 0;
-    for (ip = &itable.inode[0]; ip < &itable.inode[NINODE]; ip++) {
-        if (ip->ref > 0 && ip->dev == dev && ip->inum == inum) {
+    for (ip = itable.hash[IHASH(dev, inum)]; ip; ip = ip->hnext) {
+        if (ip->dev == dev && ip->inum == inum) {
+            if (ip->ref == 0)
+                idle_remove(ip); // still valid, reuse as is
             ip->ref++;
             release(&itable.lock);
             return ip;
         }
-        if (empty == 0 && ip->ref == 0) // Remember empty slot.
-            empty = ip;
     }
 
-    // Recycle an inode entry.
-    if (empty == 0)
+    // Allocate a new entry, or recycle an idle one.
+    if ((ip = kmem_cache_alloc(&inode_cache)) != 0) {
+        initsleeplock(&ip->lock, "inode");
+    } else if ((ip = idle_evict()) != 0) {
+        pcache_inval(ip);
+    } else {
         panic("iget: no inodes");
+    }
 
-    ip = empty;
     ip->dev = dev;
     ip->inum = inum;
     ip->ref = 1;
     ip->valid = 0;
+    ip->hnext = itable.hash[IHASH(dev, inum)];
+    itable.hash[IHASH(dev, inum)] = ip;
     release(&itable.lock);
 
     return ip;
@@ -323,8 +392,8 @@ void iunlock(struct inode* ip)
 }
 
 // Drop a reference to an in-memory inode.
-// If that was the last reference, the inode table entry can
-// be recycled.
+// If that was the last reference, the inode table entry goes
+// on the idle list, and the oldest idle entry may be freed.
 // If that was the last reference and the inode has no links
 // to it, free the inode (and its content) on disk.
 // All calls to iput() must be inside a transaction in
@@ -352,8 +421,18 @@ void iput(struct inode* ip)
         acquire(&itable.lock);
     }
 
-    ip->ref--;
+    struct inode* victim = 0;
+    if (--ip->ref == 0) {
+        idle_append(ip);
+        if (itable.nidle > NINODE)
+            victim = idle_evict();
+    }
     release(&itable.lock);
+
+    if (victim) {
+        pcache_inval(victim);
+        kmem_cache_free(&inode_cache, victim);
+    }
 }
 
 // Common idiom: unlock, then put.
@@ -443,6 +522,7 @@ void itrunc(struct inode* ip)
 
     ip->size = 0;
     iupdate(ip);
+    pcache_inval(ip);
 }
 
 // Copy stat information from inode.
@@ -460,7 +540,38 @@ void stati(struct inode* ip, struct stat* st)
 // Caller must hold ip->lock.
 // If user_dst==1, then dst is a user virtual address;
 // otherwise, dst is a kernel address.
+// The data of regular files comes from the page cache.
 int readi(struct inode* ip, int user_dst, uint64_t dst, uint_t off, uint_t n)
+{
+    uint_t tot, m;
+    char* pa;
+
+    if (ip->type != T_FILE)
+        return readi_nocache(ip, user_dst, dst, off, n);
+
+    if (off > ip->size || off + n < off)
+        return 0;
+    if (off + n > ip->size)
+        n = ip->size - off;
+
+    for (tot = 0; tot < n; tot += m, off += m, dst += m) {
+        if ((pa = pcache_get(ip, off / PGSIZE, 0)) == 0)
+            break;
+        m = min(n - tot, PGSIZE - off % PGSIZE);
+        if (either_copyout(user_dst, dst, pa + (off % PGSIZE), m) == -1) {
+            k_free(pa);
+            tot = -1;
+            break;
+        }
+        k_free(pa);
+    }
+    return tot;
+}
+
+// Read data from inode through the buffer cache, like readi()
+// but bypassing the page cache, which uses it to fill pages.
+// Caller must hold ip->lock.
+int readi_nocache(struct inode* ip, int user_dst, uint64_t dst, uint_t off, uint_t n)
 {
     uint_t tot, m;
     struct buf* bp;
@@ -481,7 +592,10 @@ int readi(struct inode* ip, int user_dst, uint64_t dst, uint_t off, uint_t n)
             tot = -1;
             break;
         }
-        brelse(bp);
+        if (ip->type == T_FILE)
+            brelse_cold(bp);
+        else
+            brelse(bp);
     }
     return tot;
 }
@@ -514,7 +628,12 @@ int writei(struct inode* ip, int user_src, uint64_t src, uint_t off, uint_t n)
             break;
         }
         log_write(bp);
-        brelse(bp);
+        if (ip->type == T_FILE) {
+            pcache_write(ip, off, (char*)bp->data + (off % BSIZE), m);
+            brelse_cold(bp);
+        } else {
+            brelse(bp);
+        }
     }
 
     if (off > ip->size)
@@ -1,6 +1,38 @@
 // Physical memory allocator, for user processes,
 // kernel stacks, page-table pages,
-// and pipe buffers. Allocates whole 4096-byte pages.
+// and pipe buffers.
+//
+// Memory between end and PHYSTOP is managed by a binary buddy
+// allocator that hands out physically contiguous blocks of
+// 2^order pages, order 0..MAXORDER. A block of order k always
+// starts at a physical address aligned to PGSIZE << k, so its
+// buddy is found by flipping one address bit.
+//
+// Single pages (order 0) are the common case, so each hart also
+// keeps a small cache of free pages, indexed by cpu_id(), and
+// k_alloc()/k_free() only touch the buddy lists (and buddy.lock)
+// once per batch of KBATCH pages. When both the hart's cache and
+// the buddy lists are empty, k_alloc() steals from another hart.
+//
+// Allocated pages carry a reference count, so that a page can be
+// shared (e.g. by copy-on-write fork); k_free() only really frees
+// a page when its last reference goes away.
+//
+// Allocated pages are also counted by what they are used for, for
+// memstat(): as kernel memory, unless the caller says otherwise
+// with k_use().
+//
+// Free memory that nobody asks for fills up with the page cache
+// (pcache.c); when both the hart caches and the buddy lists are
+// empty, k_alloc() has the page cache give some back, and failing
+// that, if the caller can sleep, swaps user pages out (swap.c).
+//
+// Most callers want a zeroed page (page tables, user memory), so
+// harts with nothing to run zero free pages ahead of time into a
+// pool (see k_zero_idle()) and k_alloc_zeroed() takes from it.
+// Built with make KJUNK=1, pages are filled with junk when they
+// are allocated and freed, to catch uses of uninitialized or
+// freed memory.
 
 #include "types.h"
 #include "param.h"
@@ -8,36 +40,301 @@
 #include "spinlock.h"
 #include "riscv.h"
 #include "defs.h"
+#include "memstat.h"
 
 void free_range(void* pa_start, void* pa_end);
 
 extern char end[]; // first address after kernel.
                    // defined by kernel.ld.
 
-/// @brief  一个链表，将 page 的首地址链接起来。内存就是一个巨大的一维数组, 这个链表也就是静态链表
+// pages moved between a hart's cache and the buddy lists at once.
+#define KBATCH 32
+
+// pages moved from another hart's cache per steal.
+#define KSTEAL 32
+
+// pre-zeroed pages kept in the pool, at most.
+#define NZPOOL 256
+
+// pages an idle hart zeroes before looking for work again.
+#define ZBATCH 8
+
+#define NPAGES ((PHYSTOP - KERNBASE) / PGSIZE)
+#define PA2IDX(pa) (((uint64_t)(pa) - KERNBASE) / PGSIZE)
+#define BLKSIZE(order) ((uint64_t)PGSIZE << (order))
+
+/// @brief  一个链表，将空闲 block 的首地址链接起来。
+/// buddy 的空闲链表是双向循环链表, hart 的 cache 只用 next.
 struct run {
     struct run* next;
+    struct run* prev;
 };
 
+// per-page metadata, indexed by PA2IDX().
+// only meaningful for the first page of a block.
+struct page {
+    uchar_t order; // block order, free or allocated
+    uchar_t free; // is the block on a buddy freelist?
+    uchar_t use; // what an allocated block is for, MU_*
+    int refcnt; // references to an allocated block, see k_ref_inc()
+};
+
+struct page pages[NPAGES];
+
+uint64_t kuse[NMU]; // allocated pages of each use, updated atomically
+
 struct {
+    struct spinlock lock;
+    struct run free[MAXORDER + 1]; // list heads, one per order
+    uint64_t nfree[MAXORDER + 1]; // blocks on each list
+} buddy;
+
+// per-hart cache of free pages, indexed by cpu_id().
+struct kmem {
     struct spinlock lock;
     struct run* freelist; // 空闲链表
-} kmem;
+    int nfree; // pages on freelist
+};
+
+struct kmem kmems[NCPU];
+
+// free pages that have already been zeroed.
+// pages in the pool are off the buddy lists, with refcnt 0.
+struct {
+    struct spinlock lock;
+    struct run* list; // through next only; the rest of the page is 0
+    int n; // pages on list
+} zpool;
+
+static void
+list_push(struct run* head, struct run* r)
+{
+    r->next = head->next;
+    r->prev = head;
+    head->next->prev = r;
+    head->next = r;
+}
+
+static void
+list_remove(struct run* r)
+{
+    r->prev->next = r->next;
+    r->next->prev = r->prev;
+}
+
+// Take a block of 2^order pages off the buddy lists,
+// splitting a larger block if necessary.
+// Caller must hold buddy.lock.
+static void*
+buddy_alloc(int order)
+{
+    int k;
+
+    for (k = order; k <= MAXORDER; k++) {
+        if (buddy.nfree[k] > 0)
+            break;
+    }
+    if (k > MAXORDER)
+        return 0;
+
+    struct run* r = buddy.free[k].next;
+    list_remove(r);
+    buddy.nfree[k]--;
+    pages[PA2IDX(r)].free = 0;
+
+    // give back the upper half until the block is the right size.
+    while (k > order) {
+        k--;
+        struct run* half = (struct run*)((char*)r + BLKSIZE(k));
+        list_push(&buddy.free[k], half);
+        buddy.nfree[k]++;
+        pages[PA2IDX(half)].order = k;
+        pages[PA2IDX(half)].free = 1;
+    }
+    pages[PA2IDX(r)].order = order;
+    return (void*)r;
+}
+
+// Put a block of 2^order pages back on the buddy lists,
+// merging it with its buddy for as long as the buddy is free.
+// Caller must hold buddy.lock.
+static void
+buddy_free(void* pa, int order)
+{
+    uint64_t a = (uint64_t)pa;
+
+    if (pages[PA2IDX(a)].free)
+        panic("buddy_free: double free");
+
+    while (order < MAXORDER) {
+        uint64_t b = a ^ BLKSIZE(order);
+        if (b < PGROUNDUP((uint64_t)end) || b + BLKSIZE(order) > PHYSTOP)
+            break;
+        struct page* bp = &pages[PA2IDX(b)];
+        if (!bp->free || bp->order != order)
+            break;
+        list_remove((struct run*)b);
+        buddy.nfree[order]--;
+        bp->free = 0;
+        if (b < a)
+            a = b;
+        order++;
+    }
+
+    list_push(&buddy.free[order], (struct run*)a);
+    buddy.nfree[order]++;
+    pages[PA2IDX(a)].order = order;
+    pages[PA2IDX(a)].free = 1;
+}
 
 void k_init()
 {
-    init_lock(&kmem.lock, "kmem");
+    init_lock(&buddy.lock, "buddy");
+    for (int k = 0; k <= MAXORDER; k++) {
+        buddy.free[k].next = buddy.free[k].prev = &buddy.free[k];
+    }
+    for (int i = 0; i < NCPU; i++) {
+        init_lock(&kmems[i].lock, "kmem");
+    }
+    init_lock(&zpool.lock, "zpool");
     free_range(end, (void*)PHYSTOP);
 }
 
-/// @brief 释放 page
-/// @param pa_start
-/// @param pa_end
+// Put the pages in [pa_start, pa_end) on the buddy lists as the
+// largest aligned blocks that fit. Only the first page of each
+// block is written (to link it in), so boot time hardly grows
+// with the amount of RAM.
 void free_range(void* pa_start, void* pa_end)
 {
-    for (char* p = (char*)PGROUNDUP((uint64_t)pa_start); p + PGSIZE <= (char*)pa_end; p += PGSIZE) {
-        k_free(p); // p 是 一个 page
+    uint64_t a = PGROUNDUP((uint64_t)pa_start);
+    uint64_t e = PGROUNDDOWN((uint64_t)pa_end);
+
+#ifdef KJUNK
+    memset((void*)a, 1, e - a);
+#endif
+    acquire(&buddy.lock);
+    while (a < e) {
+        int k = MAXORDER;
+        while (k > 0 && (a % BLKSIZE(k) != 0 || a + BLKSIZE(k) > e))
+            k--;
+        buddy_free((void*)a, k);
+        a += BLKSIZE(k);
+    }
+    release(&buddy.lock);
+}
+
+// Drop one reference to the block at pa.
+// Returns 1 if that was the last one and the block
+// should really be freed.
+static int
+k_ref_put(void* pa)
+{
+    int r = __sync_sub_and_fetch(&pages[PA2IDX(pa)].refcnt, 1);
+    if (r < 0)
+        panic("k_free: refcnt");
+    return r == 0;
+}
+
+// Add a reference to the allocated block at pa, which
+// the caller must already hold a reference to.
+// Each reference is dropped with k_free()/k_free_order().
+void k_ref_inc(void* pa)
+{
+    if ((char*)pa < end || (uint64_t)pa >= PHYSTOP)
+        panic("k_ref_inc");
+    __sync_fetch_and_add(&pages[PA2IDX(pa)].refcnt, 1);
+}
+
+// How many references are there to the block at pa?
+int k_ref_count(void* pa)
+{
+    return __atomic_load_n(&pages[PA2IDX(pa)].refcnt, __ATOMIC_SEQ_CST);
+}
+
+// Count the block of 2^order pages at pa, just allocated,
+// as kernel memory.
+static void
+use_alloc(void* pa, int order)
+{
+    pages[PA2IDX(pa)].use = MU_KERNEL;
+    __sync_fetch_and_add(&kuse[MU_KERNEL], 1UL << order);
+}
+
+// The block of 2^order pages at pa is being freed.
+static void
+use_free(void* pa, int order)
+{
+    __sync_fetch_and_sub(&kuse[pages[PA2IDX(pa)].use], 1UL << order);
+}
+
+// Count the allocated block at pa as used for use (MU_*).
+// Called by the block's owner, right after allocating it.
+void k_use(void* pa, int use)
+{
+    struct page* pg = &pages[PA2IDX(pa)];
+    uint64_t n = 1UL << pg->order;
+
+    if (use < 0 || use >= NMU)
+        panic("k_use");
+    __sync_fetch_and_sub(&kuse[pg->use], n);
+    __sync_fetch_and_add(&kuse[use], n);
+    pg->use = use;
+}
+
+// Take a page off the zeroed pool, or return 0 if it's empty.
+// The page's first word is the pool link, not zero.
+static struct run*
+zpool_pop(void)
+{
+    struct run* r;
+
+    if (zpool.n == 0)
+        return 0; // racy peek, just a hint
+    acquire(&zpool.lock);
+    if ((r = zpool.list) != 0) {
+        zpool.list = r->next;
+        zpool.n--;
+    }
+    release(&zpool.lock);
+    return r;
+}
+
+// Return every page cached by the harts, and the zeroed pool,
+// to the buddy lists, so that they can merge into larger blocks.
+static void
+k_drain(void)
+{
+    for (int i = 0; i < NCPU; i++) {
+        struct kmem* km = &kmems[i];
+        acquire(&km->lock);
+        struct run* r = km->freelist;
+        km->freelist = 0;
+        km->nfree = 0;
+        release(&km->lock);
+
+        acquire(&buddy.lock);
+        while (r) {
+            struct run* next = r->next;
+            buddy_free(r, 0);
+            r = next;
+        }
+        release(&buddy.lock);
+    }
+
+    // the zeroed pages: idle harts will zero more later.
+    acquire(&zpool.lock);
+    struct run* r = zpool.list;
+    zpool.list = 0;
+    zpool.n = 0;
+    release(&zpool.lock);
+
+    acquire(&buddy.lock);
+    while (r) {
+        struct run* next = r->next;
+        buddy_free(r, 0);
+        r = next;
     }
+    release(&buddy.lock);
 }
 
 // Free the page of physical memory pointed at by pa,
@@ -45,7 +342,8 @@ void free_range(void* pa_start, void* pa_end)
 // call to k_alloc().  (The exception is when
 // initializing the allocator; see k_init above.)
 
-/// @brief 省流: 将 pa 代表的 page 放回空闲链表中, 清空 page 是: 将 page 的所有字节置为 1
+/// @brief 省流: 将 pa 代表的 page 放回当前 hart 的 cache 中, 清空 page 是: 将 page 的所有字节置为 1
+/// cache 太满的时候, 将 KBATCH 个 page 还给 buddy
 /// @param pa
 void k_free(void* pa)
 {
@@ -55,37 +353,372 @@ void k_free(void* pa)
         panic("k_free");
     }
 
+    // still shared?
+    if (!k_ref_put(pa))
+        return;
+    use_free(pa, 0);
+
+#ifdef KJUNK
     // Fill with junk to catch dangling refs.
     // 将每个字节设置为 1
     memset(pa, 1, PGSIZE);
+#endif
 
-    // 链表: 头插
+    // 链表: 头插. push_off so we stay on this hart's cache.
     struct run* r = (struct run*)pa;
-    acquire(&kmem.lock);
-    r->next = kmem.freelist;
-    kmem.freelist = r;
-    release(&kmem.lock);
+    struct run* spill = 0;
+    push_off();
+    struct kmem* km = &kmems[cpu_id()];
+    acquire(&km->lock);
+    r->next = km->freelist;
+    km->freelist = r;
+    km->nfree++;
+    if (km->nfree > 2 * KBATCH) {
+        // detach KBATCH pages to give back to the buddy lists.
+        spill = km->freelist;
+        struct run* last = spill;
+        for (int i = 1; i < KBATCH; i++)
+            last = last->next;
+        km->freelist = last->next;
+        last->next = 0;
+        km->nfree -= KBATCH;
+    }
+    release(&km->lock);
+    pop_off();
+
+    if (spill) {
+        acquire(&buddy.lock);
+        while (spill) {
+            struct run* next = spill->next;
+            buddy_free(spill, 0);
+            spill = next;
+        }
+        release(&buddy.lock);
+    }
+}
+
+// Move up to KSTEAL pages from another hart's cache
+// onto hart id's cache, and return one of them.
+// Never holds two kmem locks at once.
+// Interrupts must be disabled.
+static struct run*
+k_steal(int id)
+{
+    for (int i = 1; i < NCPU; i++) {
+        struct kmem* victim = &kmems[(id + i) % NCPU];
+        if (victim->nfree == 0) {
+            continue; // racy peek, just a hint
+        }
+
+        acquire(&victim->lock);
+        struct run* first = victim->freelist;
+        struct run* last = 0;
+        int n = 0;
+        for (struct run* r = first; r && n < KSTEAL; r = r->next) {
+            last = r;
+            n++;
+        }
+        if (n > 0) {
+            victim->freelist = last->next;
+            victim->nfree -= n;
+        }
+        release(&victim->lock);
+
+        if (n == 0) {
+            continue;
+        }
+
+        // keep the first page for the caller, cache the rest.
+        if (n > 1) {
+            struct kmem* km = &kmems[id];
+            acquire(&km->lock);
+            last->next = km->freelist;
+            km->freelist = first->next;
+            km->nfree += n - 1;
+            release(&km->lock);
+        }
+        return first;
+    }
+    return 0;
+}
+
+// Refill hart id's cache with up to KBATCH pages from the
+// buddy lists, falling back to stealing from another hart,
+// and return one page.
+// Interrupts must be disabled.
+static struct run*
+k_refill(int id)
+{
+    struct run* first = 0;
+    struct run* last = 0;
+    int n = 0;
+
+    acquire(&buddy.lock);
+    for (; n < KBATCH; n++) {
+        struct run* r = buddy_alloc(0);
+        if (r == 0)
+            break;
+        r->next = first;
+        first = r;
+        if (last == 0)
+            last = r;
+    }
+    release(&buddy.lock);
+
+    if (n == 0)
+        return k_steal(id);
+
+    if (n > 1) {
+        struct kmem* km = &kmems[id];
+        acquire(&km->lock);
+        last->next = km->freelist;
+        km->freelist = first->next;
+        km->nfree += n - 1;
+        release(&km->lock);
+    }
+    return first;
+}
+
+// Take a free page off this hart's cache, refilling the cache
+// from the buddy lists or another hart if it is empty.
+// Returns 0 if there is none.
+static struct run*
+k_take(void)
+{
+    push_off();
+    int id = cpu_id();
+    struct kmem* km = &kmems[id];
+
+    acquire(&km->lock);
+    // 头删
+    struct run* r = km->freelist;
+    if (r) {
+        km->freelist = r->next;
+        km->nfree--;
+    }
+    release(&km->lock);
+
+    if (r == 0) {
+        r = k_refill(id);
+    }
+    pop_off();
+    return r;
+}
+
+// Out of memory: swap some user pages out, if the caller can
+// sleep, which is only in a process and only with interrupts on,
+// so holding no spinlocks. Returns the number of pages freed.
+int k_reclaim(void)
+{
+    if (!intr_get() || my_proc() == 0)
+        return 0;
+    return swap_reclaim();
 }
 
 // Allocate one 4096-byte page of physical memory.
 // Returns a pointer that the kernel can use.
 // Returns 0 if the memory cannot be allocated.
 
-/// @brief
+/// @brief 先从当前 hart 的 cache 中取, 取不到再找 buddy 批发, 最后从别的 hart 偷
 /// @param
 /// @return
 void* k_alloc(void)
 {
-    acquire(&kmem.lock);
-    // 头删
-    struct run* r = kmem.freelist;
-    if (r) {
-        kmem.freelist = r->next;
+    struct run* r = k_take();
+
+    if (r == 0) {
+        r = zpool_pop(); // the zeroed pages
+    }
+    if (r == 0 && pcache_reclaim(KBATCH) > 0) {
+        r = k_take(); // the page cache's
+    }
+    if (r == 0 && k_reclaim() > 0) {
+        r = k_take(); // last resort: user pages, written to swap
     }
-    release(&kmem.lock);
 
     if (r) { // 如果真的分配到了, 因为有可能出现: 空闲链表已经空了的情况
+#ifdef KJUNK
         memset((char*)r, 5, PGSIZE); // fill with junk
+#endif
+        pages[PA2IDX(r)].refcnt = 1;
+        use_alloc(r, 0);
+    }
+    return (void*)r;
+}
+
+// Allocate one zeroed 4096-byte page of physical memory.
+// Taken from the pool of pages zeroed by idle harts if it
+// isn't empty, so that the caller needn't zero it.
+// Returns 0 if the memory cannot be allocated.
+void* k_alloc_zeroed(void)
+{
+    struct run* r = zpool_pop();
+
+    if (r) {
+        r->next = 0; // the only non-zero word
+        pages[PA2IDX(r)].refcnt = 1;
+        use_alloc(r, 0);
+        return (void*)r;
     }
+    if ((r = k_alloc()) != 0)
+        memset((char*)r, 0, PGSIZE);
     return (void*)r;
 }
+
+// Called by scheduler() when this hart has nothing to run:
+// zero a few free pages into the pool. Returns the number of
+// pages zeroed, 0 once the pool is full or memory runs out.
+int k_zero_idle(void)
+{
+    int n;
+
+    for (n = 0; n < ZBATCH && zpool.n < NZPOOL; n++) { // racy peek at n is fine
+        struct run* r = k_take();
+        if (r == 0)
+            break;
+        memset((char*)r, 0, PGSIZE);
+
+        acquire(&zpool.lock);
+        r->next = zpool.list;
+        zpool.list = r;
+        zpool.n++;
+        release(&zpool.lock);
+    }
+    return n;
+}
+
+// k_alloc_order() and k_try_order(): a block of 2^order pages,
+// after draining the hart caches and the zeroed pool into the
+// buddy lists, if drain is set and there is none at first.
+static void*
+order_alloc(int order, int drain)
+{
+    void* pa;
+
+    if (order < 0 || order > MAXORDER)
+        panic("k_alloc_order");
+    if (order == 0)
+        return k_alloc();
+
+    acquire(&buddy.lock);
+    pa = buddy_alloc(order);
+    release(&buddy.lock);
+
+    if (pa == 0 && drain) {
+        // pages parked in the hart caches or the zeroed
+        // pool may be all that keeps a large block from forming.
+        k_drain();
+        acquire(&buddy.lock);
+        pa = buddy_alloc(order);
+        release(&buddy.lock);
+    }
+
+    if (pa) {
+#ifdef KJUNK
+        memset(pa, 5, BLKSIZE(order)); // fill with junk
+#endif
+        pages[PA2IDX(pa)].refcnt = 1;
+        use_alloc(pa, order);
+    }
+    return pa;
+}
+
+// Allocate 2^order physically contiguous pages, aligned to
+// their size. order 9 is a 2 MiB megapage.
+// Returns 0 if no block that large is free.
+void* k_alloc_order(int order)
+{
+    return order_alloc(order, 1);
+}
+
+// k_alloc_order(), but only if a block is free on the buddy
+// lists as they are, for a caller that can make do without
+// (e.g. with 4 KiB pages): k_drain() empties every hart's cache,
+// too dear to do on every try.
+void* k_try_order(int order)
+{
+    return order_alloc(order, 0);
+}
+
+// Free a block returned by k_alloc_order(order).
+void k_free_order(void* pa, int order)
+{
+    if (order < 0 || order > MAXORDER
+        || ((uint64_t)pa % BLKSIZE(order)) != 0
+        || (char*)pa < end
+        || (uint64_t)pa + BLKSIZE(order) > PHYSTOP) {
+        panic("k_free_order");
+    }
+    if (order == 0) {
+        k_free(pa);
+        return;
+    }
+
+    if (!k_ref_put(pa))
+        return;
+    use_free(pa, order);
+
+#ifdef KJUNK
+    memset(pa, 1, BLKSIZE(order));
+#endif
+
+    acquire(&buddy.lock);
+    buddy_free(pa, order);
+    release(&buddy.lock);
+}
+
+// Split an allocated block of 2^order pages into 2^order single
+// pages, each holding the block's references, so that they can
+// be freed one at a time with k_free(). Used to break a user
+// megapage up into 4 KiB pages.
+void k_split(void* pa, int order)
+{
+    uint64_t i = PA2IDX(pa);
+
+    if (order < 0 || order > MAXORDER || pages[i].order != order || pages[i].free)
+        panic("k_split");
+
+    int r = pages[i].refcnt;
+    for (uint64_t j = i; j < i + (1 << order); j++) {
+        pages[j].order = 0;
+        pages[j].use = pages[i].use;
+        pages[j].refcnt = r;
+    }
+}
+
+// Roughly how many pages are free. Takes no locks, so it's
+// cheap enough to check before every page cache fill.
+uint64_t k_nfree(void)
+{
+    uint64_t n = zpool.n;
+
+    for (int k = 0; k <= MAXORDER; k++)
+        n += buddy.nfree[k] << k;
+    for (int i = 0; i < NCPU; i++)
+        n += kmems[i].nfree;
+    return n;
+}
+
+// Fill in st with the allocator's view of free memory.
+void k_memstat(struct memstat* st)
+{
+    memset(st, 0, sizeof(*st));
+    st->npages = (PHYSTOP - PGROUNDUP((uint64_t)end)) / PGSIZE;
+
+    acquire(&buddy.lock);
+    for (int k = 0; k <= MAXORDER; k++) {
+        st->nblocks[k] = buddy.nfree[k];
+        st->nfree += buddy.nfree[k] << k;
+    }
+    release(&buddy.lock);
+
+    for (int i = 0; i < NCPU; i++) {
+        // racy, but only statistics.
+        st->ncached += kmems[i].nfree;
+    }
+    st->nzeroed = zpool.n;
+    st->nfree += st->ncached + st->nzeroed;
+    st->npcache = pcache_npages();
+    for (int u = 0; u < NMU; u++)
+        st->nuse[u] = kuse[u];
+}
@@ -0,0 +1,193 @@
+//
+// Kernel self-benchmarks, for code that user programs can't
+// time directly. Built with make KBENCH=1, they run once on
+// hart 0 during boot, before the first process, and print
+// their results to the console. Times come from the time CSR,
+// which ticks at 10 MHz on qemu's virt machine.
+//
+
+#include "types.h"
+#include "param.h"
+#include "memlayout.h"
+#include "riscv.h"
+#include "defs.h"
+
+extern pagetable_t kernel_pagetable;
+
+// print ticks per n operations as nanoseconds, with two decimals.
+static void
+print_ns(char* what, uint64_t ticks, uint64_t n)
+{
+    uint64_t cns = ticks * (1000000000UL / TIMEBASE) * 100 / n;
+    printf("kbench: %s %ld.%02ld ns\n", what, cns / 100, cns % 100);
+}
+
+//
+// TLB reach: load one word from each page of a 4 MiB block,
+// over and over, through the direct map (two megapages) and
+// through an alias of the same memory built from 4 KiB pages
+// (1024 PTEs, more than any TLB holds). The difference is the
+// cost of the TLB misses that megapages avoid. qemu's software
+// TLB is always 4 KiB-grained, so there it mostly shows the
+// shorter page-table walk; real hardware shows more.
+//
+
+#define TLB_ORDER 10 // 4 MiB, two megapages
+#define TLB_NPG (1 << TLB_ORDER)
+#define TLB_ROUNDS 64
+#define TLB_ALIAS (1L << 32) // a level-2 slot of its own
+
+static uint64_t
+tlb_sweep(char* base)
+{
+    uint64_t sum = 0;
+    uint64_t t0 = r_time();
+    for (int r = 0; r < TLB_ROUNDS; r++) {
+        // a different cache line in each page, so that the
+        // loads don't all compete for the same cache sets.
+        for (int i = 0; i < TLB_NPG; i++)
+            sum += *(volatile uint64_t*)(base + (uint64_t)i * PGSIZE + (i % 64) * 64);
+    }
+    (void)sum;
+    return r_time() - t0;
+}
+
+static void
+tlbbench(void)
+{
+    char* blk = k_alloc_order(TLB_ORDER);
+    if (blk == 0) {
+        printf("kbench: tlb: out of memory\n");
+        return;
+    }
+
+    // the alias: map_pages() would use megapages for an aligned
+    // range, so hand it one page at a time.
+    for (int i = 0; i < TLB_NPG; i++) {
+        uint64_t off = (uint64_t)i * PGSIZE;
+        if (map_pages(kernel_pagetable, TLB_ALIAS + off, PGSIZE, (uint64_t)blk + off, PTE_R | PTE_W) != 0)
+            panic("tlbbench: map");
+    }
+    sfence_vma();
+
+    tlb_sweep(blk); // warm the caches
+    uint64_t mega = tlb_sweep(blk);
+    uint64_t small = tlb_sweep((char*)TLB_ALIAS);
+    print_ns("tlb: load via 2 MiB pages", mega, (uint64_t)TLB_ROUNDS * TLB_NPG);
+    print_ns("tlb: load via 4 KiB pages", small, (uint64_t)TLB_ROUNDS * TLB_NPG);
+
+    // take the alias down, page-table pages and all.
+    uvm_unmap(kernel_pagetable, TLB_ALIAS, TLB_NPG, 0);
+    pte_t* pte = &kernel_pagetable[PX(2, TLB_ALIAS)];
+    freewalk((pagetable_t)PTE2PA(*pte));
+    *pte = 0;
+    sfence_vma();
+
+    k_free_order(blk, TLB_ORDER);
+}
+
+//
+// string.c: bytes per cycle of memset(), memmove() and memcmp()
+// on a page and on 64 KiB, next to plain byte loops like the
+// ones they replace. With RVV=1, the vector versions, if the
+// harts have the V extension.
+//
+
+#define STR_ORDER 4 // 64 KiB
+#define STR_ROUNDS 32
+
+static void
+print_bpc(char* what, uint64_t n, uint64_t bytes, uint64_t cycles)
+{
+    uint64_t c = bytes * 100 / (cycles ? cycles : 1);
+    printf("kbench: string: %s %ld bytes %ld.%02ld bytes/cycle\n", what, n, c / 100, c % 100);
+}
+
+static void
+byte_set(volatile char* d, int c, uint64_t n)
+{
+    while (n-- > 0)
+        *d++ = c;
+}
+
+static void
+byte_copy(volatile char* d, volatile char* s, uint64_t n)
+{
+    while (n-- > 0)
+        *d++ = *s++;
+}
+
+static int
+byte_cmp(volatile char* a, volatile char* b, uint64_t n)
+{
+    for (; n > 0; n--, a++, b++) {
+        if (*a != *b)
+            return *a - *b;
+    }
+    return 0;
+}
+
+static void
+stringbench(void)
+{
+    uint64_t sizes[] = { PGSIZE, PGSIZE << STR_ORDER }, t;
+    char* a = k_alloc_order(STR_ORDER);
+    char* b = k_alloc_order(STR_ORDER);
+    int r;
+
+    if (a == 0 || b == 0) {
+        printf("kbench: string: out of memory\n");
+        return;
+    }
+#ifdef RVV
+    printf("kbench: string: vector extension %s\n", rvv ? "in use" : "absent");
+#endif
+    for (int i = 0; i < NELEM(sizes); i++) {
+        uint64_t n = sizes[i], bytes = n * STR_ROUNDS;
+
+        t = r_cycle();
+        for (r = 0; r < STR_ROUNDS; r++)
+            byte_set(a, r, n);
+        print_bpc("byte loop set", n, bytes, r_cycle() - t);
+        t = r_cycle();
+        for (r = 0; r < STR_ROUNDS; r++)
+            memset(a, r, n);
+        print_bpc("memset", n, bytes, r_cycle() - t);
+
+        t = r_cycle();
+        for (r = 0; r < STR_ROUNDS; r++)
+            byte_copy(b, a, n);
+        print_bpc("byte loop copy", n, bytes, r_cycle() - t);
+        t = r_cycle();
+        for (r = 0; r < STR_ROUNDS; r++)
+            memmove(b, a, n);
+        print_bpc("memmove", n, bytes, r_cycle() - t);
+        t = r_cycle();
+        for (r = 0; r < STR_ROUNDS; r++)
+            memmove(a + 8, a, n - 8); // overlapping, backwards
+        print_bpc("memmove backwards", n, bytes, r_cycle() - t);
+
+        memmove(b, a, n);
+        t = r_cycle();
+        for (r = 0; r < STR_ROUNDS; r++) {
+            if (byte_cmp(a, b, n) != 0)
+                panic("stringbench: cmp");
+        }
+        print_bpc("byte loop cmp", n, bytes, r_cycle() - t);
+        t = r_cycle();
+        for (r = 0; r < STR_ROUNDS; r++) {
+            if (memcmp(a, b, n) != 0)
+                panic("stringbench: memcmp");
+        }
+        print_bpc("memcmp", n, bytes, r_cycle() - t);
+    }
+
+    k_free_order(a, STR_ORDER);
+    k_free_order(b, STR_ORDER);
+}
+
+void kbench(void)
+{
+    tlbbench();
+    stringbench();
+}
@@ -16,19 +16,35 @@ void main()
         printf("\n");
         printf("xv6 kernel is booting\n");
         printf("\n");
+        fdt_init(); // boot arguments, before k_init() frees their memory
+        if (*fdt_bootargs())
+            printf("boot arguments: %s\n", fdt_bootargs());
+        uint64_t t0 = r_time(); // the time CSR starts at 0 on reset
         k_init(); // physical page allocator
+        uint64_t t1 = r_time();
         kvm_init(); // create kernel page table
         kvm_init_hart(); // turn on paging
         proc_init(); // process table
+        runq_init(); // run queues
+        waitq_init(); // sleep()'s wait queues
         trapinit(); // trap vectors
         trapinithart(); // install kernel trap vector
         plicinit(); // set up interrupt controller
         plicinithart(); // ask PLIC for device interrupts
         binit(); // buffer cache
         iinit(); // inode table
+        pcache_init(); // file page cache
+        swap_init(); // swap area
         file_init(); // file table
+        pipe_init(); // pipe cache
+        shm_init(); // shared memory segments
         virtio_disk_init(); // emulated hard disk
+#ifdef KBENCH
+        kbench(); // kernel self-benchmarks
+#endif
         user_init(); // first user process
+        printf("boot: %ld us since reset, k_init %ld us\n",
+            r_time() / (TIMEBASE / 1000000), (t1 - t0) / (TIMEBASE / 1000000));
         __sync_synchronize();
         started = 1;
     } else {
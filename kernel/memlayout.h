@@ -17,6 +17,17 @@
 // end -- start of kernel page allocation area
 // PHYSTOP -- end RAM used by the kernel
 
+// the time CSR counts at this rate, in ticks per second.
+#define TIMEBASE 10000000
+
+// a timer tick, a tenth of a second of the time CSR.
+#define TICK (TIMEBASE / 10)
+
+// core-local interruptor (CLINT), which has each hart's
+// machine-mode software interrupt bit (see machinevec).
+#define CLINT 0x2000000
+#define CLINT_MSIP(hart) (CLINT + 4 * (hart))
+
 // qemu puts UART registers here in physical memory.
 #define UART0 0x10000000L
 #define UART0_IRQ 10
@@ -57,7 +68,21 @@
 //   fixed-size stack
 //   expandable heap
 //   ...
+//   mmap() regions, placed top-down from MMAPTOP
 //   TRAPFRAME (p->trap_frame, used by the trampoline)
 //   TRAMPOLINE (the same page as in the kernel)
 // trap frame
 #define TRAPFRAME (TRAMPOLINE - PGSIZE)
+#define MMAPTOP TRAPFRAME
+
+// With SHAREKVM, user page tables map the devices and RAM at
+// the kernel's addresses too (see kvm_share()), which takes
+// those away from user programs: the heap ends below PLIC, and
+// mmap() regions stay above the 1 GiB that holds the RAM.
+#ifdef SHAREKVM
+#define HEAPTOP PLIC
+#define MMAPBASE (3L << 30)
+#else
+#define HEAPTOP MMAPTOP
+#define MMAPBASE 0L
+#endif
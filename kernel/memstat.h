@@ -0,0 +1,26 @@
+// Physical memory statistics, filled in by the memstat() system call.
+// Both the kernel and user programs use this header file.
+
+// what allocated pages are used for (see k_use()).
+#define MU_KERNEL 0 // anything else: slabs, trap frames, disk rings, ...
+#define MU_USER 1 // user memory: heap, stack, program, mmap()s, segments
+#define MU_PGTBL 2 // page-table pages
+#define MU_KSTACK 3 // kernel stacks
+#define MU_PIPE 4 // pipes
+#define MU_PCACHE 5 // the page cache
+#define NMU 6
+
+struct memstat {
+    uint64_t npages; // pages managed by the allocator
+    uint64_t nfree; // free pages, buddy lists plus hart caches plus zeroed pool
+    uint64_t ncached; // free pages parked in the per-hart caches
+    uint64_t nzeroed; // free pages zeroed ahead of time by idle harts
+    uint64_t npcache; // allocated pages held by the page cache, reclaimable if unmapped
+    uint64_t nswap; // page slots in the swap area
+    uint64_t nswapused; // slots holding a page
+    uint64_t nswapin; // pages read back from swap since boot
+    uint64_t nswapout; // pages written to swap since boot
+    uint64_t nblocks[MAXORDER + 1]; // free buddy blocks of each order
+    uint64_t nuse[NMU]; // allocated pages by use, MU_*
+    uint64_t nbcache; // pages of buffer cache, part of the kernel image
+};
@@ -0,0 +1,12 @@
+// Arguments to the mmap() system call.
+// Both the kernel and user programs use this header file.
+
+#define PROT_READ 0x1
+#define PROT_WRITE 0x2
+#define PROT_EXEC 0x4
+
+#define MAP_SHARED 0x01 // stores reach the file and other mappers
+#define MAP_PRIVATE 0x02 // copy-on-write
+#define MAP_ANONYMOUS 0x20 // zero-filled memory, no file
+
+#define MAP_FAILED ((void*)-1)
@@ -1,8 +1,7 @@
 #define NPROC 64 // maximum number of processes
 #define NCPU 8 // maximum number of CPUs
 #define NOFILE 16 // open files per process
-#define NFILE 100 // open files per system
-#define NINODE 50 // maximum number of active i-nodes
+#define NINODE 50 // maximum number of idle (unreferenced) i-nodes kept cached
 #define NDEV 10 // maximum major device number
 #define ROOTDEV 1 // device number of file system root disk
 #define MAXARG 32 // max exec arguments
@@ -10,5 +9,11 @@
 #define LOGSIZE (MAXOPBLOCKS * 3) // max data blocks in on-disk log
 #define NBUF (MAXOPBLOCKS * 3) // size of disk block cache
 #define FSSIZE 2000 // size of file system in blocks
+#define SWAPSIZE 8192 // size of the swap area, after the file system, in blocks
 #define MAXPATH 128 // maximum file path name
 #define USERSTACK 1 // user stack pages
+#define MAXORDER 10 // largest buddy block is 2^MAXORDER pages
+#define NVMA 16 // mappings (program segments and mmap()s) per process
+#define NSHM 32 // shared memory segments (shmget())
+#define NICE_MIN -20 // best nice value (setpriority())
+#define NICE_MAX 19 // worst
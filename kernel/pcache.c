@@ -0,0 +1,255 @@
+// Page cache.
+//
+// Whole pages of file data. readi() and writei() go through it
+// for regular files, so a file's working set stays in memory
+// rather than in the few blocks of the buffer cache (which is
+// left to directories and other metadata), and the processes
+// that map a file share its pages (see vma.c).
+//
+// A cached page is an ordinary k_alloc() page. The cache holds
+// one reference to it and every mapping of it holds another, so
+// dropping a page from the cache never pulls it out from under
+// a process that has it mapped; k_free() releases it once the
+// last user is gone.
+//
+// Pages are found by (inode, page number) through a hash table,
+// and are chained off their in-memory inode so that itrunc() can
+// drop a file's stale pages, as must the inode table before it
+// reuses an entry. writei() writes through: the buffer cache and
+// the log carry the data to disk, and a cached page is updated
+// in place if only the cache has it, or if a MAP_SHARED mapping
+// has it, which must see the write. A page mapped only privately
+// (MAP_PRIVATE or a program's text, copy-on-write) must not, so
+// it is dropped instead, and the next reader reads it anew.
+//
+// There is no fixed size. The cache grows while free memory
+// lasts, and gives up its least recently used pages that no
+// process has mapped when free memory runs low (PCACHE_MINFREE)
+// or k_alloc() runs out.
+//
+// Interface:
+// * pcache_get() returns a page of a file, reading it if needed.
+// * pcache_write() updates a cached page after writei().
+// * pcache_inval() drops all the cached pages of a file.
+// * pcache_reclaim() gives pages back to the allocator.
+
+#include "types.h"
+#include "param.h"
+#include "riscv.h"
+#include "spinlock.h"
+#include "sleeplock.h"
+#include "defs.h"
+#include "fs.h"
+#include "file.h"
+#include "slab.h"
+#include "memstat.h"
+
+struct cpage {
+    struct inode* ip;
+    uint_t pgno; // page number within the file
+    char* pa;
+    int shared; // mapped MAP_SHARED, see pcache_write()
+    struct cpage* hnext; // hash chain
+    struct cpage* inext; // ip->pages chain
+    struct cpage* next; // LRU list
+    struct cpage* prev;
+};
+
+#define NPHASH 1031
+#define PCACHE_MINFREE 512 // a miss evicts rather than take the last free pages
+#define PHASH(ip, pgno) ((((uint64_t)(ip) / sizeof(struct inode)) + (pgno)) % NPHASH)
+
+struct {
+    struct spinlock lock;
+    struct cpage* hash[NPHASH];
+
+    // Linked list of all cached pages, through prev/next.
+    // head.next is most recent, head.prev is least.
+    struct cpage head;
+    int n;
+} pcache;
+
+static struct kmem_cache cpage_cache;
+
+void pcache_init(void)
+{
+    init_lock(&pcache.lock, "pcache");
+    pcache.head.prev = &pcache.head;
+    pcache.head.next = &pcache.head;
+    kmem_cache_init(&cpage_cache, "cpage", sizeof(struct cpage));
+}
+
+// Put cp at the most recently used end of the LRU list.
+// Caller must hold pcache.lock.
+static void
+lru_push(struct cpage* cp)
+{
+    cp->next = pcache.head.next;
+    cp->prev = &pcache.head;
+    pcache.head.next->prev = cp;
+    pcache.head.next = cp;
+}
+
+static void
+lru_remove(struct cpage* cp)
+{
+    cp->next->prev = cp->prev;
+    cp->prev->next = cp->next;
+}
+
+// Take cp out of the cache and drop the cache's reference
+// to its page. Caller must hold pcache.lock.
+static void
+pcache_drop(struct cpage* cp)
+{
+    struct cpage** pp;
+
+    for (pp = &pcache.hash[PHASH(cp->ip, cp->pgno)]; *pp != cp; pp = &(*pp)->hnext)
+        ;
+    *pp = cp->hnext;
+    for (pp = &cp->ip->pages; *pp != cp; pp = &(*pp)->inext)
+        ;
+    *pp = cp->inext;
+    lru_remove(cp);
+    pcache.n--;
+
+    k_free(cp->pa);
+    kmem_cache_free(&cpage_cache, cp);
+}
+
+// Return page pgno of ip's content, zero-filled past the end
+// of the file, with a reference held for the caller (to be
+// dropped with k_free()). The page is shared: don't write it,
+// unless shared is set, for a MAP_SHARED mapping.
+// Returns 0 if out of memory.
+// Caller must hold ip->lock.
+char*
+pcache_get(struct inode* ip, uint_t pgno, int shared)
+{
+    struct cpage* cp;
+    char* pa;
+
+    if (!holdingsleep(&ip->lock))
+        panic("pcache_get");
+
+    acquire(&pcache.lock);
+    for (cp = pcache.hash[PHASH(ip, pgno)]; cp; cp = cp->hnext) {
+        if (cp->ip == ip && cp->pgno == pgno) {
+            lru_remove(cp);
+            lru_push(cp);
+            // if only the cache has it, earlier shared
+            // mappings of it are gone.
+            cp->shared = shared || (cp->shared && k_ref_count(cp->pa) > 1);
+            k_ref_inc(cp->pa);
+            release(&pcache.lock);
+            return cp->pa;
+        }
+    }
+    release(&pcache.lock);
+
+    // Not cached; read it. Pages of ip are only added with
+    // ip->lock held, so nobody else can add this one meanwhile.
+    if (k_nfree() < PCACHE_MINFREE)
+        pcache_reclaim(1);
+    if ((pa = k_alloc_zeroed()) == 0)
+        return 0;
+    if (readi_nocache(ip, 0, (uint64_t)pa, pgno * PGSIZE, PGSIZE) < 0) {
+        k_free(pa);
+        return 0;
+    }
+    if ((cp = kmem_cache_alloc(&cpage_cache)) == 0)
+        return pa; // can't cache it; the caller has the only reference
+
+    cp->ip = ip;
+    cp->pgno = pgno;
+    cp->pa = pa;
+    cp->shared = shared;
+    k_ref_inc(pa); // one for the cache, one for the caller
+    k_use(pa, MU_PCACHE); // even after it's dropped, if still mapped
+
+    acquire(&pcache.lock);
+    cp->hnext = pcache.hash[PHASH(ip, pgno)];
+    pcache.hash[PHASH(ip, pgno)] = cp;
+    cp->inext = ip->pages;
+    ip->pages = cp;
+    lru_push(cp);
+    pcache.n++;
+    release(&pcache.lock);
+
+    return pa;
+}
+
+// writei() has just stored the n bytes at src into ip's data at
+// off, all within one page: copy them into the cached page, if
+// there is one and nobody has it mapped or a shared mapping has
+// it, else drop it from the cache. Caller must hold ip->lock.
+void pcache_write(struct inode* ip, uint_t off, char* src, uint_t n)
+{
+    struct cpage* cp;
+
+    if (ip->pages == 0) // see pcache_inval()
+        return;
+
+    acquire(&pcache.lock);
+    for (cp = ip->pages; cp; cp = cp->inext) {
+        if (cp->pgno == off / PGSIZE) {
+            if (k_ref_count(cp->pa) == 1)
+                cp->shared = 0;
+            if (k_ref_count(cp->pa) > 1 && !cp->shared)
+                pcache_drop(cp); // private mappings keep the old data
+            else
+                memmove(cp->pa + off % PGSIZE, src, n);
+            break;
+        }
+    }
+    release(&pcache.lock);
+}
+
+// Drop all the cached pages of ip, because its content has
+// changed or the in-memory inode is about to go away.
+// Processes that have those pages mapped keep them.
+void pcache_inval(struct inode* ip)
+{
+    // Pages are only added to ip under ip->lock, which callers
+    // either hold or (ip being unreferenced) nobody can, so a
+    // racy look is enough to skip the usual case of an inode
+    // with nothing cached.
+    if (ip->pages == 0)
+        return;
+
+    acquire(&pcache.lock);
+    while (ip->pages)
+        pcache_drop(ip->pages);
+    release(&pcache.lock);
+}
+
+// Drop up to n of the least recently used pages that nobody
+// else holds, for an allocator short of memory.
+// Returns the number of pages freed.
+int pcache_reclaim(int n)
+{
+    struct cpage *cp, *prev;
+    int freed = 0;
+
+    // k_alloc() may be called with either lock held, e.g. by
+    // kmem_cache_alloc() growing cpage_cache.
+    if (holding(&pcache.lock) || holding(&cpage_cache.lock))
+        return 0;
+
+    acquire(&pcache.lock);
+    for (cp = pcache.head.prev; cp != &pcache.head && freed < n; cp = prev) {
+        prev = cp->prev;
+        if (k_ref_count(cp->pa) == 1) { // not mapped, not being read
+            pcache_drop(cp);
+            freed++;
+        }
+    }
+    release(&pcache.lock);
+    return freed;
+}
+
+// The number of pages in the cache, for memstat().
+int pcache_npages(void)
+{
+    return pcache.n;
+}
@@ -7,6 +7,8 @@
 #include "fs.h"
 #include "sleeplock.h"
 #include "file.h"
+#include "slab.h"
+#include "memstat.h"
 
 #define PIPESIZE 512
 
@@ -19,6 +21,16 @@ struct pipe {
     int writeopen; // write fd is still open
 };
 
+// a struct pipe is much smaller than a page,
+// so pipes are packed into slabs.
+static struct kmem_cache pipe_cache;
+
+void pipe_init(void)
+{
+    kmem_cache_init(&pipe_cache, "pipe", sizeof(struct pipe));
+    pipe_cache.use = MU_PIPE;
+}
+
 int pipealloc(struct file** f0, struct file** f1)
 {
     struct pipe* pi;
@@ -27,7 +39,7 @@ int pipealloc(struct file** f0, struct file** f1)
     *f0 = *f1 = 0;
     if ((*f0 = file_alloc()) == 0 || (*f1 = file_alloc()) == 0)
         goto bad;
-    if ((pi = (struct pipe*)k_alloc()) == 0)
+    if ((pi = (struct pipe*)kmem_cache_alloc(&pipe_cache)) == 0)
         goto bad;
     pi->readopen = 1;
     pi->writeopen = 1;
@@ -46,7 +58,7 @@ int pipealloc(struct file** f0, struct file** f1)
 
 bad:
     if (pi)
-        k_free((char*)pi);
+        kmem_cache_free(&pipe_cache, pi);
     if (*f0)
         fileclose(*f0);
     if (*f1)
@@ -66,7 +78,7 @@ void pipeclose(struct pipe* pi, int writable)
     }
     if (pi->readopen == 0 && pi->writeopen == 0) {
         release(&pi->lock);
-        k_free((char*)pi);
+        kmem_cache_free(&pipe_cache, pi);
     } else
         release(&pi->lock);
 }
@@ -84,7 +96,7 @@ int pipewrite(struct pipe* pi, uint64_t addr, int n)
         }
         if (pi->nwrite == pi->nread + PIPESIZE) { // DOC: pipewrite-full
             wakeup(&pi->nread);
-            sleep(&pi->nwrite, &pi->lock);
+            sleep_user(&pi->nwrite, &pi->lock, addr + i, n - i);
         } else {
             char ch;
             if (copyin(pr->pagetable, &ch, addr + i, 1) == -1)
@@ -111,7 +123,8 @@ int piperead(struct pipe* pi, uint64_t addr, int n)
             release(&pi->lock);
             return -1;
         }
-        sleep(&pi->nread, &pi->lock); // DOC: piperead-sleep
+        sched_io_boost();
+        sleep_user(&pi->nread, &pi->lock, addr, n); // DOC: piperead-sleep
     }
     for (i = 0; i < n; i++) { // DOC: piperead-copy
         if (pi->nread == pi->nwrite)
@@ -5,6 +5,8 @@
 #include "spinlock.h"
 #include "proc.h"
 #include "defs.h"
+#include "memstat.h"
+#include "pstat.h"
 
 struct cpu cpus[NCPU];
 
@@ -32,7 +34,8 @@ struct spinlock wait_lock;
 
 // Allocate a page for each process's kernel stack.
 // Map it high in memory, followed by an invalid
-// guard page.
+// guard page. (With SHAREKVM, use it where the direct
+// map has it; see kvm_share().)
 void proc_map_stacks(pagetable_t kpgtbl)
 {
     struct proc* p;
@@ -42,8 +45,14 @@ void proc_map_stacks(pagetable_t kpgtbl)
         if (pa == 0) {
             panic("k_alloc");
         }
+        k_use(pa, MU_KSTACK);
+#ifdef SHAREKVM
+        p->kstack = (uint64_t)pa;
+#else
         uint64_t va = KSTACK((int)(p - procs));
         k_vm_map(kpgtbl, va, (uint64_t)pa, PGSIZE, PTE_R | PTE_W);
+        p->kstack = va;
+#endif
     }
 }
 
@@ -55,7 +64,6 @@ void proc_init(void)
     for (struct proc* p = procs; p < &procs[NPROC] /* 遍历数组 */; p++) {
         init_lock(&p->lock, "proc");
         p->state = UNUSED;
-        p->kstack = KSTACK((int)(p - procs));
     }
 }
 
@@ -117,6 +125,14 @@ static struct proc* alloc_proc(void)
 found:
     p->pid = alloc_pid();
     p->state = USED;
+    memset(p->asids, 0, sizeof(p->asids)); // none yet on any hart
+    p->nice = 0;
+    p->level = 0; // new processes start at the top
+    p->slice = 0;
+    p->vruntime = 0;
+    p->runtime = 0;
+    p->waittime = 0;
+    p->nrun = 0;
 
     // Allocate a trap_frame page.
     if ((p->trap_frame = (struct trap_frame*)k_alloc()) == 0) {
@@ -195,6 +211,14 @@ pagetable_t proc_pagetable(struct proc* p)
         return 0;
     }
 
+#ifdef SHAREKVM
+    // and the kernel, so that traps needn't switch page tables.
+    if (kvm_share(pagetable) < 0) {
+        proc_free_pagetable(pagetable, 0);
+        return 0;
+    }
+#endif
+
     return pagetable;
 }
 
@@ -202,6 +226,9 @@ pagetable_t proc_pagetable(struct proc* p)
 // physical memory it refers to.
 void proc_free_pagetable(pagetable_t pagetable, uint64_t sz)
 {
+#ifdef SHAREKVM
+    kvm_unshare(pagetable);
+#endif
     uvm_unmap(pagetable, TRAMPOLINE, 1, 0);
     uvm_unmap(pagetable, TRAPFRAME, 1, 0);
     uvmfree(pagetable, sz);
@@ -238,12 +265,15 @@ void user_init(void)
     safestrcpy(p->name, "initcode", sizeof(p->name));
     p->cwd = namei("/");
 
-    p->state = RUNNABLE;
+    runq_add(p);
 
     release(&p->lock);
 }
 
 // Grow or shrink user memory by n bytes.
+// Growing only moves p->sz: the pages are allocated and
+// zeroed on first touch, by vma_fault(), 2 MiB at a time
+// where the heap is big enough (see uvm_megapage()).
 // Return 0 on success, -1 on failure.
 int growproc(int n)
 {
@@ -252,11 +282,15 @@ int growproc(int n)
 
     sz = p->sz;
     if (n > 0) {
-        if ((sz = uvm_alloc(p->pagetable, sz, sz + n, PTE_W)) == 0) {
+        if (sz + n > vma_floor(p)) {
             return -1;
         }
+        sz += n;
     } else if (n < 0) {
-        sz = uvmdealloc(p->pagetable, sz, sz + n);
+        if ((sz = uvmdealloc(p->pagetable, sz, sz + n)) == p->sz) {
+            return -1;
+        }
+        vma_trim(p, sz);
     }
     p->sz = sz;
     return 0;
@@ -270,18 +304,33 @@ int fork(void)
     struct proc* np;
     struct proc* p = my_proc();
 
+    // Shared mappings have to be all there for the child to
+    // share them; filling them in may sleep, so do it now.
+    if (vma_populate_shared(p) < 0) {
+        return -1;
+    }
+
     // Allocate process.
     if ((np = alloc_proc()) == 0) {
         return -1;
     }
 
-    // Copy user memory from parent to child.
+    // Copy user memory from parent to child. This write-protects
+    // the parent's pages, so its TLB entries go stale.
     if (uvmcopy(p->pagetable, np->pagetable, p->sz) < 0) {
         free_proc(np);
         release(&np->lock);
+        tlb_invalidate(p, 0, -1);
         return -1;
     }
     np->sz = p->sz;
+    if (vma_copy(np, p) < 0) {
+        free_proc(np);
+        release(&np->lock);
+        tlb_invalidate(p, 0, -1);
+        return -1;
+    }
+    tlb_invalidate(p, 0, -1);
 
     // copy saved user registers.
     *(np->trap_frame) = *(p->trap_frame);
@@ -296,6 +345,8 @@ int fork(void)
     np->cwd = idup(p->cwd);
 
     safestrcpy(np->name, p->name, sizeof(p->name));
+    np->nice = p->nice;
+    np->vruntime = p->vruntime;
 
     pid = np->pid;
 
@@ -306,7 +357,55 @@ int fork(void)
     release(&wait_lock);
 
     acquire(&np->lock);
-    np->state = RUNNABLE;
+    runq_add(np);
+    release(&np->lock);
+
+    return pid;
+}
+
+// Create a new process running the program at path with
+// arguments argv, as fork() and exec() would, but without
+// copying the parent's memory only to throw it away: the
+// child's image is built directly by exec_proc(). The child's
+// file descriptors 0-2 are files[0-2], which may be 0; it gets
+// no others. Returns the child's pid, or -1.
+int spawn(char* path, char** argv, struct file** files)
+{
+    int i, argc, pid;
+    struct proc* np;
+    struct proc* p = my_proc();
+
+    if ((np = alloc_proc()) == 0) {
+        return -1;
+    }
+    // np is USED, so nothing else touches it; exec_proc()
+    // sleeps, so don't hold its lock.
+    release(&np->lock);
+
+    memset(np->trap_frame, 0, sizeof(*np->trap_frame));
+    if ((argc = exec_proc(np, path, argv)) < 0) {
+        acquire(&np->lock);
+        free_proc(np);
+        release(&np->lock);
+        return -1;
+    }
+    np->trap_frame->a0 = argc;
+
+    for (i = 0; i < 3; i++)
+        if (files[i])
+            np->ofile[i] = filedup(files[i]);
+    np->cwd = idup(p->cwd);
+    np->nice = p->nice;
+    np->vruntime = p->vruntime;
+
+    pid = np->pid;
+
+    acquire(&wait_lock);
+    np->parent = p;
+    release(&wait_lock);
+
+    acquire(&np->lock);
+    runq_add(np);
     release(&np->lock);
 
     return pid;
@@ -345,8 +444,12 @@ void exit(int status)
         }
     }
 
+    // Write back and let go of mmap()ed memory.
+    vma_munmap_all(p);
+
     begin_op();
     iput(p->cwd);
+    vma_put(p->vmas);
     end_op();
     p->cwd = 0;
 
@@ -361,6 +464,7 @@ void exit(int status)
     acquire(&p->lock);
 
     p->xstate = status;
+    sched_charge(p);
     p->state = ZOMBIE;
 
     release(&wait_lock);
@@ -378,6 +482,10 @@ int wait(uint64_t addr)
     int havekids, pid;
     struct proc* p = my_proc();
 
+    // the copyout() below runs with locks held.
+    if (addr != 0)
+        vma_prefault(p, addr, sizeof(int));
+
     acquire(&wait_lock);
 
     for (;;) {
@@ -413,14 +521,14 @@ int wait(uint64_t addr)
         }
 
         // Wait for a child to exit.
-        sleep(p, &wait_lock); // DOC: wait-sleep
+        sleep_user(p, &wait_lock, addr, addr ? sizeof(int) : 0); // DOC: wait-sleep
     }
 }
 
 // Per-CPU process scheduler.
 // Each CPU calls scheduler() after setting itself up.
 // Scheduler never returns.  It loops, doing:
-//  - choose a process to run.
+//  - choose a process to run, from the run queues (sched.c).
 //  - swtch to start running that process.
 //  - eventually that process transfers control
 //    via swtch back to the scheduler.
@@ -436,29 +544,35 @@ void scheduler(void)
         // processes are waiting.
         intr_on();
 
-        int found = 0;
-        for (p = procs; p < &procs[NPROC]; p++) {
-            acquire(&p->lock);
-            if (p->state == RUNNABLE) {
-                // Switch to chosen process.  It is the process's job
-                // to release its lock and then reacquire it
-                // before jumping back to us.
-                p->state = RUNNING;
-                c->proc = p;
-                swtch(&c->context, &p->context);
-
-                // Process is done running for now.
-                // It should have changed its p->state before coming back.
-                c->proc = 0;
-                found = 1;
-            }
-            release(&p->lock);
-        }
-        if (found == 0) {
-            // nothing to run; stop running on this core until an interrupt.
-            intr_on();
-            asm volatile("wfi");
+        // this thread never leaves its hart, so cpu_id() is
+        // safe here even with interrupts on.
+        if ((p = runq_take(cpu_id())) == 0) {
+            // nothing to run, and no pages to zero?
+            // stop running on this core until an interrupt.
+            if (k_zero_idle() == 0)
+                sched_idle();
+            continue;
         }
+
+        acquire(&p->lock);
+        if (p->state != RUNNABLE)
+            panic("scheduler: not runnable");
+        // Switch to chosen process.  It is the process's job
+        // to release its lock and then reacquire it
+        // before jumping back to us.
+        sched_run(p);
+        p->state = RUNNING;
+        c->proc = p;
+        c->resched = 0;
+        swtch(&c->context, &p->context);
+
+        // Process is done running for now.
+        // It should have changed its p->state before coming back.
+        // Get off its page table, which may be freed once
+        // p->lock is released.
+        kvm_switch(0);
+        c->proc = 0;
+        release(&p->lock);
     }
 }
 
@@ -493,7 +607,7 @@ void yield(void)
 {
     struct proc* p = my_proc();
     acquire(&p->lock);
-    p->state = RUNNABLE;
+    runq_add(p);
     sched();
     release(&p->lock);
 }
@@ -521,25 +635,61 @@ void fork_ret(void)
     usertrapret();
 }
 
+// Sleeping processes wait on a hash table of queues, keyed
+// by chan, so that wakeup() looks only at processes that might
+// be sleeping on its chan rather than at all of procs[]. A
+// process is on a wait queue exactly when it is SLEEPING.
+//
+// Lock order: a wait queue's lock, then p->lock.
+
+#define NWAITQ 64 // a power of 2
+
+struct waitq {
+    struct spinlock lock;
+    struct proc* head; // linked through p->wq_next
+};
+
+struct waitq waitqs[NWAITQ];
+
+static struct waitq*
+chan_waitq(void* chan)
+{
+    // Fibonacci hashing: the high bits of the product depend
+    // on all of the address, whatever its alignment.
+    return &waitqs[((uint64_t)chan * 0x9e3779b97f4a7c15UL) >> (64 - 6)];
+}
+
+void waitq_init(void)
+{
+    for (int i = 0; i < NWAITQ; i++)
+        init_lock(&waitqs[i].lock, "waitq");
+}
+
 // Atomically release lock and sleep on chan.
 // Reacquires lock when awakened.
 void sleep(void* chan, struct spinlock* lk)
 {
     struct proc* p = my_proc();
+    struct waitq* q = chan_waitq(chan);
 
-    // Must acquire p->lock in order to
-    // change p->state and then call sched.
-    // Once we hold p->lock, we can be
-    // guaranteed that we won't miss any wakeup
-    // (wakeup locks p->lock),
-    // so it's okay to release lk.
+    // Must be on chan's wait queue, and hold p->lock in
+    // order to change p->state and then call sched.
+    // Once we are on the queue, we can be guaranteed that
+    // we won't miss any wakeup (wakeup locks the queue,
+    // then p->lock), so it's okay to release lk.
 
+    acquire(&q->lock);
     acquire(&p->lock); // DOC: sleeplock1
-    release(lk);
 
     // Go to sleep.
+    sched_charge(p);
     p->chan = chan;
     p->state = SLEEPING;
+    p->wq_next = q->head;
+    q->head = p;
+
+    release(&q->lock);
+    release(lk);
 
     sched();
 
@@ -551,21 +701,70 @@ void sleep(void* chan, struct spinlock* lk)
     acquire(lk);
 }
 
+// sleep(), for a system call that waits holding lk before it
+// copies to or from the user buffer [va, va+len), as piperead()
+// does. Asleep, the process can have its pages swapped out; if
+// some were, fault the buffer back in once awake, since the
+// copy can't sleep to do it under lk. The caller rechecks what
+// it waits for, as lk may have been let go meanwhile.
+void sleep_user(void* chan, struct spinlock* lk, uint64_t va, uint64_t len)
+{
+    struct proc* p = my_proc();
+
+    p->swappable = 1;
+    p->swapped = 0;
+    sleep(chan, lk);
+    p->swappable = 0; // running again, so swap.c leaves it be
+
+    if (p->swapped) {
+        release(lk);
+        vma_prefault(p, va, len);
+        acquire(lk);
+    }
+}
+
 // Wake up all processes sleeping on chan.
 // Must be called without any p->lock.
 void wakeup(void* chan)
 {
-    struct proc* p;
-
-    for (p = procs; p < &procs[NPROC]; p++) {
-        if (p != my_proc()) {
-            acquire(&p->lock);
-            if (p->state == SLEEPING && p->chan == chan) {
-                p->state = RUNNABLE;
-            }
-            release(&p->lock);
+    struct waitq* q = chan_waitq(chan);
+    struct proc *p, **pp;
+
+    // Callers hold the lock that sleepers on chan pass to
+    // sleep(), which they give up only once on q, so an empty
+    // queue can be seen without taking its lock. This keeps
+    // wakeups that nobody waits for, like most of the clock's,
+    // cheap.
+    if (__atomic_load_n(&q->head, __ATOMIC_ACQUIRE) == 0)
+        return;
+
+    acquire(&q->lock);
+    for (pp = &q->head; (p = *pp) != 0;) {
+        acquire(&p->lock);
+        if (p->chan == chan) {
+            *pp = p->wq_next;
+            runq_add(p);
+        } else {
+            pp = &p->wq_next;
         }
+        release(&p->lock);
     }
+    release(&q->lock);
+}
+
+// Take p, which is SLEEPING, off its wait queue and make it
+// RUNNABLE, whatever it is waiting for. Caller must hold
+// p->lock and q->lock, where q is chan_waitq(p->chan).
+static void
+waitq_remove(struct waitq* q, struct proc* p)
+{
+    struct proc** pp;
+
+    for (pp = &q->head; *pp != p; pp = &(*pp)->wq_next)
+        if (*pp == 0)
+            panic("waitq_remove");
+    *pp = p->wq_next;
+    runq_add(p);
 }
 
 // Kill the process with the given pid.
@@ -580,8 +779,16 @@ int kill(int pid)
         if (p->pid == pid) {
             p->killed = 1;
             if (p->state == SLEEPING) {
-                // Wake process from sleep().
-                p->state = RUNNABLE;
+                // Wake process from sleep(). The queue's lock
+                // comes first, so look again once we have both.
+                void* chan = p->chan;
+                struct waitq* q = chan_waitq(chan);
+                release(&p->lock);
+                acquire(&q->lock);
+                acquire(&p->lock);
+                if (p->pid == pid && p->state == SLEEPING && p->chan == chan)
+                    waitq_remove(q, p);
+                release(&q->lock);
             }
             release(&p->lock);
             return 0;
@@ -591,6 +798,53 @@ int kill(int pid)
     return -1;
 }
 
+// Set the nice value of the process with the given pid, or of
+// the caller if pid is 0, to nice, clamped to NICE_MIN..NICE_MAX.
+// It counts from the next time the process is queued.
+// Returns 0, or -1 if there is no such process.
+int setnice(int pid, int nice)
+{
+    struct proc* p;
+
+    if (nice < NICE_MIN)
+        nice = NICE_MIN;
+    if (nice > NICE_MAX)
+        nice = NICE_MAX;
+    if (pid == 0)
+        pid = my_proc()->pid;
+    for (p = procs; p < &procs[NPROC]; p++) {
+        acquire(&p->lock);
+        if (p->pid == pid && p->state != UNUSED) {
+            p->nice = nice;
+            release(&p->lock);
+            return 0;
+        }
+        release(&p->lock);
+    }
+    return -1;
+}
+
+// Store the nice value of the process with the given pid, or
+// of the caller if pid is 0, in *nice.
+// Returns 0, or -1 if there is no such process.
+int getnice(int pid, int* nice)
+{
+    struct proc* p;
+
+    if (pid == 0)
+        pid = my_proc()->pid;
+    for (p = procs; p < &procs[NPROC]; p++) {
+        acquire(&p->lock);
+        if (p->pid == pid && p->state != UNUSED) {
+            *nice = p->nice;
+            release(&p->lock);
+            return 0;
+        }
+        release(&p->lock);
+    }
+    return -1;
+}
+
 void setkilled(struct proc* p)
 {
     acquire(&p->lock);
@@ -636,31 +890,72 @@ int either_copyin(void* dst, int user_src, uint64_t src, uint64_t len)
     }
 }
 
+static char* states[] = {
+    [UNUSED] "unused",
+    [USED] "used",
+    [SLEEPING] "sleep ",
+    [RUNNABLE] "runble",
+    [RUNNING] "run   ",
+    [ZOMBIE] "zombie"
+};
+
+static char*
+state_name(enum proc_state s)
+{
+    if (s >= 0 && s < NELEM(states) && states[s])
+        return states[s];
+    return "???";
+}
+
 // Print a process listing to console.  For debugging.
 // Runs when user types ^P on console.
 // No lock to avoid wedging a stuck machine further.
 void procdump(void)
 {
-    static char* states[] = {
-        [UNUSED] "unused",
-        [USED] "used",
-        [SLEEPING] "sleep ",
-        [RUNNABLE] "runble",
-        [RUNNING] "run   ",
-        [ZOMBIE] "zombie"
-    };
     struct proc* p;
-    char* state;
 
     printf("\n");
     for (p = procs; p < &procs[NPROC]; p++) {
         if (p->state == UNUSED)
             continue;
-        if (p->state >= 0 && p->state < NELEM(states) && states[p->state])
-            state = states[p->state];
-        else
-            state = "???";
-        printf("%d %s %s", p->pid, state, p->name);
+        printf("%d %s %s", p->pid, state_name(p->state), p->name);
         printf("\n");
     }
 }
+
+// Copy a struct pstat for each process, up to n of them, to
+// the user array at addr. Returns how many, or -1.
+int proc_stat(uint64_t addr, int n)
+{
+    struct proc* p;
+    struct pstat ps;
+    int i = 0;
+
+    for (p = procs; p < &procs[NPROC] && i < n; p++) {
+        acquire(&p->lock);
+        if (p->state == UNUSED) {
+            release(&p->lock);
+            continue;
+        }
+        ps.pid = p->pid;
+        safestrcpy(ps.state, state_name(p->state), sizeof(ps.state));
+        safestrcpy(ps.name, p->name, sizeof(ps.name));
+        ps.sz = p->sz;
+        ps.nice = p->nice;
+        ps.prio = proc_prio(p);
+        ps.runtime = p->runtime;
+        if (p->state == RUNNING) // not charged yet for this run
+            ps.runtime += r_time() - p->run_start;
+        ps.runtime /= TIMEBASE / 1000000;
+        ps.waittime = p->waittime / (TIMEBASE / 1000000);
+        ps.nrun = p->nrun;
+        uvm_stat(p->pagetable, &ps);
+        release(&p->lock);
+
+        // not under p->lock: copyout() may fault a page in.
+        if (copyout(my_proc()->pagetable, addr + i * sizeof(ps), (char*)&ps, sizeof(ps)) < 0)
+            return -1;
+        i++;
+    }
+    return i;
+}
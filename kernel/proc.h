@@ -24,6 +24,10 @@ struct cpu {
     struct context context; // swtch() here to enter scheduler().
     int n_off; // Depth of push_off() nesting.
     int int_ena; // Were interrupts enabled before push_off()?
+    uint64_t asid_gen; // Generation of the ASIDs handed out, see asid_satp()
+    uint_t asid_next; // Next ASID to hand out
+    int resched; // A better process than proc is runnable here, see sched.c
+    int idle; // In wfi with nothing to run; kick() it for more, see sched.c
 };
 
 extern struct cpu cpus[NCPU];
@@ -86,6 +90,29 @@ enum proc_state { UNUSED,
     RUNNING,
     ZOMBIE };
 
+// The ASID a process has on one hart, valid while gen matches
+// the hart's asid_gen (see asid_satp()).
+struct asid {
+    uint64_t gen; // 0 if none
+    uint_t id;
+};
+
+// A range of user memory whose pages are filled in on first
+// touch (see vma.c). exec() makes one for each loadable segment
+// of the program, and mmap() makes them above p->sz.
+struct vma {
+    uint64_t start; // first address, page-aligned
+    uint64_t end; // one past the last, page-aligned
+    int perm; // PTE_R, PTE_W, PTE_X
+    int flags; // MAP_SHARED or MAP_PRIVATE, plus VMA_MMAP; 0 if the slot is free
+    struct inode* ip; // backing file, or 0 for anonymous memory
+    struct shm* shm; // or a shmget() segment
+    uint_t off; // file (or segment) offset of start, page-aligned
+    uint_t filesz; // bytes of file data from start, zeroes after
+};
+
+#define VMA_MMAP 0x100 // made by mmap(); lives above p->sz
+
 // Per-process state
 struct proc {
     struct spinlock lock;
@@ -96,6 +123,23 @@ struct proc {
     int killed; // If non-zero, have been killed
     int xstate; // Exit status to be returned to parent's wait
     int pid; // Process ID
+    int swappable; // Stopped where swap.c may take its pages
+    int swapped; // swap.c took some, see sleep_user()
+    int nice; // NICE_MIN..NICE_MAX, see setpriority()
+    int level; // feedback level, see sched.c
+    int slice; // timer ticks run at this level
+    uint64_t rq_since; // r_time() when last made RUNNABLE
+    uint64_t run_start; // r_time() when last started running or charged
+    uint64_t vruntime; // runtime weighted by nice, see sched.c
+    uint64_t runtime; // time spent running, in time CSR units
+    uint64_t waittime; // time spent RUNNABLE, waiting to run
+    uint64_t nrun; // times scheduled
+
+    // the run queue's lock must be held when using this:
+    struct proc* rq_next; // next on a run queue, while RUNNABLE (see sched.c)
+
+    // the wait queue's lock must be held when using this:
+    struct proc* wq_next; // next on a wait queue, while SLEEPING (see sleep())
 
     // wait_lock must be held when using this:
     struct proc* parent; // Parent process
@@ -104,9 +148,11 @@ struct proc {
     uint64_t kstack; // Virtual address of kernel stack
     uint64_t sz; // Size of process memory (bytes)
     pagetable_t pagetable; // User page table
+    struct asid asids[NCPU]; // ASIDs of pagetable, per hart
     struct trap_frame* trap_frame; // data page for trampoline.S
     struct context context; // swtch() here to run process
     struct file* ofile[NOFILE]; // Open files
     struct inode* cwd; // Current directory
+    struct vma vmas[NVMA]; // Demand-paged mappings
     char name[16]; // Process name (debugging)
 };
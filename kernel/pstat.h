@@ -0,0 +1,17 @@
+// Per-process statistics, filled in by the pstat() system call.
+// Both the kernel and user programs use this header file.
+
+struct pstat {
+    int pid;
+    char state[8];
+    char name[16];
+    int nice; // see setpriority()
+    int prio; // run queue, 0 the best (see sched.c)
+    uint64_t runtime; // time spent running, microseconds
+    uint64_t waittime; // time spent runnable, waiting to run, microseconds
+    uint64_t nrun; // times scheduled
+    uint64_t sz; // size of the heap, bytes
+    uint64_t rss; // user pages resident in memory, shared ones included
+    uint64_t nswap; // user pages out in swap
+    uint64_t npt; // page-table pages
+};
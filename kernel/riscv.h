@@ -38,6 +38,8 @@ static inline void w_mepc(uint64_t x)
 
 // Supervisor Status Register, sstatus
 
+#define SSTATUS_VS (3L << 9) // vector unit state, 0 if off
+#define SSTATUS_VS_INITIAL (1L << 9) // vector unit on, registers clean
 #define SSTATUS_SPP (1L << 8) // Previous mode, 1=Supervisor, 0=User
 #define SSTATUS_SPIE (1L << 5) // Supervisor Previous Interrupt Enable
 #define SSTATUS_UPIE (1L << 4) // User Previous Interrupt Enable
@@ -86,6 +88,7 @@ static inline void w_sie(uint64_t x)
 }
 
 // Machine-mode Interrupt Enable
+#define MIE_MSIE (1L << 3) // machine software
 #define MIE_STIE (1L << 5) // supervisor timer
 static inline uint64_t r_mie()
 {
@@ -140,6 +143,18 @@ static inline void w_mideleg(uint64_t x)
     asm volatile("csrw mideleg, %0" : : "r"(x));
 }
 
+// Machine-mode Trap-Vector Base Address
+static inline void w_mtvec(uint64_t x)
+{
+    asm volatile("csrw mtvec, %0" : : "r"(x));
+}
+
+// Machine-mode scratch register, for machinevec.
+static inline void w_mscratch(uint64_t x)
+{
+    asm volatile("csrw mscratch, %0" : : "r"(x));
+}
+
 // Supervisor Trap-Vector Base Address
 // low two bits are mode.
 static inline void w_stvec(uint64_t x)
@@ -196,7 +211,13 @@ static inline void w_pmpaddr0(uint64_t x)
 // use riscv's sv39 page table scheme.
 #define SATP_SV39 (8L << 60)
 
-#define MAKE_SATP(pagetable) (SATP_SV39 | (((uint64_t)pagetable) >> 12))
+// the address-space ID field, which tags TLB entries so that
+// switching page tables needn't flush them (see asid_satp()).
+#define SATP_ASID_SHIFT 44
+#define SATP_ASID_MASK (0xFFFFL << SATP_ASID_SHIFT)
+
+#define MAKE_SATP(pagetable, asid) \
+    (SATP_SV39 | ((uint64_t)(asid) << SATP_ASID_SHIFT) | (((uint64_t)pagetable) >> 12))
 
 // supervisor address translation and protection;
 // holds the address of the page table.
@@ -243,6 +264,19 @@ static inline uint64_t r_mcounteren()
     return x;
 }
 
+// Supervisor-mode Counter-Enable
+static inline void w_scounteren(uint64_t x)
+{
+    asm volatile("csrw scounteren, %0" : : "r"(x));
+}
+
+static inline uint64_t r_scounteren()
+{
+    uint64_t x;
+    asm volatile("csrr %0, scounteren" : "=r"(x));
+    return x;
+}
+
 // machine-mode cycle counter
 static inline uint64_t r_time()
 {
@@ -251,6 +285,22 @@ static inline uint64_t r_time()
     return x;
 }
 
+// cycles executed by this hart.
+static inline uint64_t r_cycle()
+{
+    uint64_t x;
+    asm volatile("csrr %0, cycle" : "=r"(x));
+    return x;
+}
+
+// the ISA extensions of this hart, a bit per letter.
+static inline uint64_t r_misa()
+{
+    uint64_t x;
+    asm volatile("csrr %0, misa" : "=r"(x));
+    return x;
+}
+
 // enable device interrupts
 static inline void intr_on()
 {
@@ -312,6 +362,18 @@ static inline void sfence_vma()
     asm volatile("sfence.vma zero, zero");
 }
 
+// flush the TLB entries of one address space.
+static inline void sfence_vma_asid(uint64_t asid)
+{
+    asm volatile("sfence.vma zero, %0" : : "r"(asid));
+}
+
+// flush the TLB entries for va in one address space.
+static inline void sfence_vma_page(uint64_t va, uint64_t asid)
+{
+    asm volatile("sfence.vma %0, %1" : : "r"(va), "r"(asid));
+}
+
 typedef uint64_t pte_t;
 typedef uint64_t* pagetable_t; // 512 PTEs, 数组
 
@@ -324,11 +386,21 @@ typedef uint64_t* pagetable_t; // 512 PTEs, 数组
 #define PGROUNDUP(sz) (((sz) + PGSIZE - 1) & ~(PGSIZE - 1))
 #define PGROUNDDOWN(a) (((a)) & ~(PGSIZE - 1))
 
+// a level-1 leaf PTE maps a 2 MiB megapage.
+#define MEGAPGSIZE (PGSIZE * 512) // bytes per megapage
+#define MEGAPGROUNDUP(sz) (((sz) + MEGAPGSIZE - 1) & ~(MEGAPGSIZE - 1))
+#define MEGAPGROUNDDOWN(a) (((a)) & ~(MEGAPGSIZE - 1))
+
 #define PTE_V (1L << 0) // valid
 #define PTE_R (1L << 1)
 #define PTE_W (1L << 2)
 #define PTE_X (1L << 3)
 #define PTE_U (1L << 4) // user can access
+#define PTE_G (1L << 5) // global: in every address space
+#define PTE_A (1L << 6) // accessed, set by the hardware
+#define PTE_D (1L << 7) // dirty, set by the hardware on a store
+#define PTE_COW (1L << 8) // RSW bit: copy-on-write, see cow_fault()
+#define PTE_SWAP (1L << 9) // RSW bit, with PTE_V clear: in swap, see swap.c
 
 // shift a physical address to the right place for a PTE.
 #define PA2PTE(pa) ((((uint64_t)pa) >> 12) << 10)
@@ -338,6 +410,14 @@ typedef uint64_t* pagetable_t; // 512 PTEs, 数组
 
 #define PTE_FLAGS(pte) ((pte) & 0x3FF)
 
+// the swap slot of a PTE_SWAP PTE sits where the PPN would.
+#define PTE2SLOT(pte) ((pte) >> 10)
+#define SLOT2PTE(s) (((uint64_t)(s)) << 10)
+
+// a valid PTE with any of R/W/X set is a leaf; otherwise
+// it points to the next level page table.
+#define PTE_LEAF(pte) ((pte) & (PTE_R | PTE_W | PTE_X))
+
 // extract the three 9-bit page table indices from a virtual address.
 #define PXMASK 0x1FF // 9 bits
 #define PXSHIFT(level) (PGSHIFT /* 12 */ + (9 * (level)))
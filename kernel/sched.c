@@ -0,0 +1,519 @@
+//
+// Run queues and the scheduling policy.
+//
+// Each hart has its own queues of RUNNABLE processes, so that
+// picking the next process to run touches only those, not
+// every process in procs[] and its lock. A process that becomes
+// runnable goes on the queues of the hart that makes it so: the
+// parent's for fork(), the waker's for wakeup(), its own for
+// yield(). That hart will get to it when the current process
+// blocks or its time slice ends, and its cache is likely to
+// hold what the process was just given. A hart with nothing to
+// run steals the best process of the hart with the most queued
+// before it goes idle, which spreads the work out.
+//
+// There are three policies, picked at boot with the boot
+// argument sched= (see fdt.c): mlfq, the default, rr or fair.
+//
+// mlfq is a multilevel feedback queue. A process starts
+// at level 0 and may run for a time slice of 1 << level ticks
+// before it is preempted and moves down a level, to at most
+// NLEVEL-1; so CPU-bound processes sink and get long slices,
+// while those that block early stay up. Blocking to read the
+// console or a pipe, as interactive programs do, puts a process
+// back at level 0. The queue a process waits on is its level
+// shifted down by its nice value (setpriority()), a quarter of
+// the NICE_MIN..NICE_MAX range per queue. Each queue is a FIFO,
+// and the best non-empty one runs first, except that a process
+// that has waited STARVE (a second) goes ahead of better ones,
+// so nothing starves.
+//
+// rr is plain round robin: one FIFO queue, and a time slice of
+// one tick for everyone; nice values make no difference.
+//
+// fair shares the CPU out in proportion to weights given by
+// nice values, as Linux's CFS does. Each process has a virtual
+// runtime, the time it has run (by the time CSR) scaled down by
+// its weight, and the runnable process with the least runs
+// next, so heavier processes get to run for longer before
+// another overtakes them. The queue is a min-heap on virtual
+// runtime. A process that wakes up after sleeping is put no
+// further back than LATENCY/2 behind the least on the queue,
+// so it runs soon but can't make up for all the time it slept,
+// and a process stolen by another hart starts level with that
+// hart's queue.
+//
+// A process that becomes runnable on a hart whose current
+// process is on a worse queue (or, under fair, is more than
+// WAKEUP ahead in virtual runtime) preempts it at the next trap (sched_preempt()),
+// rather than wait for the end of its slice.
+//
+// Whatever the policy, the time each process spends running and
+// waiting to run is kept, for pstat().
+//
+// A hart with nothing to run or steal waits in wfi, and once
+// every hart is idle it stops its timer tick too (sched_idle()),
+// so that an idle machine leaves the host alone. A busy hart
+// whose queue grows past one process kicks an idle one, to
+// steal from it.
+//
+// A process is on a queue exactly when it is RUNNABLE; the hart
+// that takes it off is the one that will run it.
+//
+// Lock order: p->lock, then a hart's queues' lock. scheduler()
+// takes a process off a queue before it acquires the process's
+// lock.
+//
+
+#include "types.h"
+#include "param.h"
+#include "memlayout.h"
+#include "riscv.h"
+#include "spinlock.h"
+#include "proc.h"
+#include "defs.h"
+
+#define NLEVEL 4 // feedback levels
+#define NPRIO (NLEVEL + 3) // queues: a level, plus 0-3 for nice
+#define STARVE TIMEBASE // waiting that gets a process run regardless
+#define LATENCY TICK // see fair_place()
+#define WAKEUP (TIMEBASE / 100) // see runs_before()
+#define NICE0 1024 // weight of nice 0
+
+enum { SCHED_MLFQ,
+    SCHED_RR,
+    SCHED_FAIR };
+
+static char* policies[] = {
+    [SCHED_MLFQ] "mlfq",
+    [SCHED_RR] "rr",
+    [SCHED_FAIR] "fair",
+};
+
+static int policy = SCHED_MLFQ;
+
+// Weights for nice NICE_MIN..NICE_MAX under fair, Linux's: each
+// step is about 1.25x, so that one nice value more gives up
+// about 10% of the CPU to a process that's otherwise equal.
+static const uint_t weights[NICE_MAX - NICE_MIN + 1] = {
+    88761, 71755, 56483, 46273, 36291,
+    29154, 23254, 18705, 14949, 11916,
+    9548, 7620, 6100, 4904, 3906,
+    3121, 2501, 1991, 1586, 1277,
+    1024, 820, 655, 526, 423,
+    335, 272, 215, 172, 137,
+    110, 87, 70, 56, 45,
+    36, 29, 23, 18, 15,
+};
+
+struct runq {
+    struct spinlock lock;
+    int n; // processes on the queues; read without the lock to pick a victim
+
+    // mlfq and rr: FIFOs linked through p->rq_next.
+    struct proc* head[NPRIO]; // next to run, per queue
+    struct proc* tail[NPRIO];
+
+    // fair: a min-heap of n processes on p->vruntime.
+    struct proc* heap[NPROC];
+    uint64_t min_vruntime; // least of the heap and the running process; never goes back
+};
+
+struct runq runqs[NCPU];
+
+void runq_init(void)
+{
+    char name[8];
+    int i;
+
+    for (i = 0; i < NCPU; i++)
+        init_lock(&runqs[i].lock, "runq");
+
+    if (bootarg("sched", name, sizeof(name))) {
+        for (i = 0; i < NELEM(policies); i++)
+            if (strncmp(name, policies[i], sizeof(name)) == 0)
+                break;
+        if (i < NELEM(policies))
+            policy = i;
+        else
+            printf("sched: no policy %s\n", name);
+    }
+    printf("sched: %s\n", policies[policy]);
+}
+
+// The queue p waits on under mlfq, 0 the best; rr has only 0.
+int proc_prio(struct proc* p)
+{
+    if (policy != SCHED_MLFQ)
+        return 0;
+    return p->level + (p->nice - NICE_MIN) * 4 / (NICE_MAX - NICE_MIN + 1);
+}
+
+// Virtual runtimes wrap around, so compare them by difference.
+static int
+vbefore(uint64_t a, uint64_t b)
+{
+    return (long)(a - b) < 0;
+}
+
+// The virtual runtime of p, which is running on this hart, as
+// of now.
+static uint64_t
+vruntime_now(struct proc* p)
+{
+    return p->vruntime + (r_time() - p->run_start) * NICE0 / weights[p->nice - NICE_MIN];
+}
+
+// Charge p, running on this hart, for the time since it started
+// or was last charged. Caller must hold p->lock.
+void sched_charge(struct proc* p)
+{
+    uint64_t now = r_time();
+
+    p->vruntime = vruntime_now(p);
+    p->runtime += now - p->run_start;
+    p->run_start = now;
+}
+
+// p, taken off a queue by runq_take(), is about to run on this
+// hart. Caller must hold p->lock.
+void sched_run(struct proc* p)
+{
+    p->run_start = r_time();
+    p->waittime += p->run_start - p->rq_since;
+    p->nrun++;
+}
+
+static void
+mlfq_push(struct runq* rq, struct proc* p)
+{
+    int q = proc_prio(p);
+
+    p->rq_next = 0;
+    if (rq->tail[q])
+        rq->tail[q]->rq_next = p;
+    else
+        rq->head[q] = p;
+    rq->tail[q] = p;
+    rq->n++;
+}
+
+static struct proc*
+mlfq_pop(struct runq* rq)
+{
+    struct proc* p;
+    int q, best = -1;
+
+    for (q = 0; q < NPRIO; q++) {
+        if ((p = rq->head[q]) == 0)
+            continue;
+        if (best < 0)
+            best = q;
+        if (r_time() - p->rq_since >= STARVE) {
+            best = q;
+            break;
+        }
+    }
+    p = rq->head[best];
+    rq->head[best] = p->rq_next;
+    if (rq->head[best] == 0)
+        rq->tail[best] = 0;
+    rq->n--;
+    return p;
+}
+
+// Bring rq->min_vruntime up to the least virtual runtime of the
+// processes on rq and cur, the one running on this hart, if any.
+static void
+fair_update_min(struct runq* rq, struct proc* cur)
+{
+    uint64_t v;
+
+    if (cur) {
+        v = vruntime_now(cur);
+        if (rq->n > 0 && vbefore(rq->heap[0]->vruntime, v))
+            v = rq->heap[0]->vruntime;
+    } else if (rq->n > 0) {
+        v = rq->heap[0]->vruntime;
+    } else {
+        return;
+    }
+    if (vbefore(rq->min_vruntime, v))
+        rq->min_vruntime = v;
+}
+
+// Place p, which has just woken up or been made, among rq's
+// processes: no further back than LATENCY/2 behind the least,
+// since it's owed a little for the time it slept but not all
+// of it, and no further than LATENCY ahead, in case it last ran
+// on a hart whose virtual runtimes were further along.
+static void
+fair_place(struct runq* rq, struct proc* p)
+{
+    uint64_t lo = rq->min_vruntime - LATENCY / 2;
+    uint64_t hi = rq->min_vruntime + LATENCY;
+
+    if (vbefore(p->vruntime, lo))
+        p->vruntime = lo;
+    else if (vbefore(hi, p->vruntime))
+        p->vruntime = hi;
+}
+
+static void
+fair_push(struct runq* rq, struct proc* p)
+{
+    int i = rq->n++;
+
+    // sift up.
+    while (i > 0 && vbefore(p->vruntime, rq->heap[(i - 1) / 2]->vruntime)) {
+        rq->heap[i] = rq->heap[(i - 1) / 2];
+        i = (i - 1) / 2;
+    }
+    rq->heap[i] = p;
+}
+
+static struct proc*
+fair_pop(struct runq* rq)
+{
+    struct proc* p = rq->heap[0];
+    struct proc* last = rq->heap[--rq->n];
+    int i = 0, c;
+
+    // sift last down from the top.
+    while ((c = 2 * i + 1) < rq->n) {
+        if (c + 1 < rq->n && vbefore(rq->heap[c + 1]->vruntime, rq->heap[c]->vruntime))
+            c++;
+        if (!vbefore(rq->heap[c]->vruntime, last->vruntime))
+            break;
+        rq->heap[i] = rq->heap[c];
+        i = c;
+    }
+    rq->heap[i] = last;
+    if (vbefore(rq->min_vruntime, p->vruntime))
+        rq->min_vruntime = p->vruntime;
+    return p;
+}
+
+// Should p, just made runnable, preempt cur, running on this
+// hart? cur is the process that called us, or that we
+// interrupted, so its fields hold still without its lock.
+static int
+runs_before(struct proc* p, struct proc* cur)
+{
+    if (policy == SCHED_FAIR)
+        return vbefore(p->vruntime + WAKEUP, vruntime_now(cur));
+    return proc_prio(p) < proc_prio(cur);
+}
+
+// Interrupt hart, to get it out of wfi: ask machine mode to
+// raise a software interrupt there (see machinevec).
+static void
+kick(int hart)
+{
+    register uint64_t a0 asm("a0") = hart;
+    asm volatile("ecall" : "+r"(a0) : : "memory");
+}
+
+// Kick an idle hart, if there is one, to steal work from here.
+static void
+kick_idle(void)
+{
+    for (int i = 0; i < NCPU; i++) {
+        if (i != cpu_id() && cpus[i].idle && __sync_lock_test_and_set(&cpus[i].idle, 0)) {
+            kick(i);
+            return;
+        }
+    }
+}
+
+// Make p RUNNABLE and put it on this hart's queues.
+// Caller must hold p->lock.
+void runq_add(struct proc* p)
+{
+    if (!holding(&p->lock))
+        panic("runq_add");
+
+    // p->lock has interrupts off, so we stay on this hart.
+    struct cpu* c = my_cpu();
+    struct runq* rq = &runqs[cpu_id()];
+    int woke = p->state != RUNNING; // else yield()
+    int n;
+
+    if (!woke)
+        sched_charge(p);
+    p->state = RUNNABLE;
+    p->rq_since = r_time();
+
+    acquire(&rq->lock);
+    if (policy == SCHED_FAIR) {
+        fair_update_min(rq, c->proc);
+        if (woke)
+            fair_place(rq, p);
+        fair_push(rq, p);
+    } else {
+        mlfq_push(rq, p);
+    }
+    n = rq->n;
+    release(&rq->lock);
+
+    // preempt this hart's process, if p should run first.
+    if (c->proc != 0 && c->proc != p && runs_before(p, c->proc))
+        c->resched = 1;
+
+    // if this hart is busy with others besides p, have an idle
+    // one take something. (p alone will run here once the
+    // current process blocks, as it usually does soon after a
+    // wakeup, or its slice ends.) release() above was a fence,
+    // so a hart that sets its idle after we look sees the queue
+    // (see sched_idle()).
+    if (c->proc != 0 && n > 1)
+        kick_idle();
+}
+
+// Take the next process to run off rq, if any.
+static struct proc*
+runq_pop(struct runq* rq)
+{
+    struct proc* p = 0;
+
+    acquire(&rq->lock);
+    if (rq->n > 0)
+        p = policy == SCHED_FAIR ? fair_pop(rq) : mlfq_pop(rq);
+    release(&rq->lock);
+    return p;
+}
+
+// Return the next process for hart id to run, or 0 if there is
+// nothing runnable anywhere. The process is off the queues, and
+// is still RUNNABLE; the caller must acquire its lock, which
+// the hart that queued it may still hold for a moment (see
+// sched()), and run it.
+struct proc*
+runq_take(int id)
+{
+    struct proc* p;
+
+    if ((p = runq_pop(&runqs[id])) != 0)
+        return p;
+
+    // steal from the busiest hart. Another thief may get there
+    // first, so try again while there's anything to steal.
+    for (;;) {
+        struct runq* victim = 0;
+        int most = 0;
+        for (int i = 0; i < NCPU; i++) {
+            int n = __atomic_load_n(&runqs[i].n, __ATOMIC_RELAXED);
+            if (i != id && n > most) {
+                most = n;
+                victim = &runqs[i];
+            }
+        }
+        if (victim == 0)
+            return 0;
+        if ((p = runq_pop(victim)) != 0)
+            break;
+    }
+
+    if (policy == SCHED_FAIR) {
+        // victim's virtual runtimes mean nothing here. The hart
+        // that queued p is done with it (runq_add() charged it),
+        // so p->vruntime is ours to set.
+        acquire(&runqs[id].lock);
+        p->vruntime = runqs[id].min_vruntime;
+        release(&runqs[id].lock);
+    }
+    return p;
+}
+
+// Nothing to run on this hart, nothing to steal, and no pages
+// to zero: wait for an interrupt. While other harts are running
+// processes, keep ticking, to look for work to steal at least
+// once a tick as before; a busy hart only kicks us when its
+// queue grows past one. Once all are idle, the timer is set only
+// for the next sleeper that's due (timer_idle()), if any, and
+// the hart sleeps until then, or until a device interrupt or a
+// kick. Interrupts are off from the last look at the queues to the
+// wfi, so one that makes a process runnable can't slip in
+// between: wfi wakes for a pending interrupt all the same, and
+// it's taken once they're back on. Likewise a busy hart that
+// queues a process after we set c->idle either is seen here
+// or sees c->idle and kicks us.
+void sched_idle(void)
+{
+    int busy = 0;
+
+    intr_off();
+    struct cpu* c = my_cpu();
+
+    c->idle = 1;
+    __sync_synchronize();
+    for (int i = 0; i < NCPU; i++) {
+        if (__atomic_load_n(&runqs[i].n, __ATOMIC_RELAXED) > 0)
+            goto out;
+        if (&cpus[i] != c && __atomic_load_n(&cpus[i].proc, __ATOMIC_RELAXED) != 0)
+            busy = 1;
+    }
+    if (busy)
+        timer_busy();
+    else
+        timer_idle();
+    asm volatile("wfi");
+out:
+    c->idle = 0;
+    timer_busy(); // in case there's something to run now
+    intr_on();
+}
+
+// Called by the current process on a trap: should it give up
+// the CPU? It should if a better process has become runnable
+// on this hart since it started, or on tick (a timer interrupt)
+// if its time slice is over, which under mlfq also moves it
+// down a level. Under fair, the slice is over once a process
+// on the queue is behind it in virtual runtime.
+int sched_preempt(int tick)
+{
+    struct proc* p = my_proc();
+    int r;
+
+    // no lock for the usual case, a system call with nothing
+    // better waiting.
+    push_off();
+    r = my_cpu()->resched;
+    my_cpu()->resched = 0;
+    pop_off();
+
+    if (!tick)
+        return r;
+
+    acquire(&p->lock);
+    if (policy == SCHED_FAIR) {
+        struct runq* rq = &runqs[cpu_id()];
+        sched_charge(p);
+        acquire(&rq->lock);
+        if (rq->n > 0 && vbefore(rq->heap[0]->vruntime, p->vruntime))
+            r = 1;
+        release(&rq->lock);
+    } else if (++p->slice >= (1 << p->level)) {
+        if (policy == SCHED_MLFQ && p->level < NLEVEL - 1)
+            p->level++;
+        p->slice = 0;
+        r = 1;
+    }
+    release(&p->lock);
+    return r;
+}
+
+// The current process is about to block for input from the
+// console or a pipe: under mlfq, treat it as interactive, at
+// the top level with a fresh time slice.
+void sched_io_boost(void)
+{
+    struct proc* p = my_proc();
+
+    if (policy != SCHED_MLFQ)
+        return;
+    acquire(&p->lock);
+    p->level = 0;
+    p->slice = 0;
+    release(&p->lock);
+}
@@ -0,0 +1,163 @@
+//
+// Shared memory segments.
+//
+// shmget() returns a file descriptor for a segment of zeroed
+// memory, and mmap(MAP_SHARED) of that descriptor maps it: all
+// the processes that map a segment see the same physical pages,
+// so they can hand each other bulk data without copying it
+// through a pipe. A segment made with key 0 is anonymous, and
+// reaches only the children the process forks, like Linux's
+// memfd_create(); any other key names the segment system-wide,
+// so that unrelated processes can find it, as System V's
+// shmget() does.
+//
+// A segment holds a reference to each of its pages, and each
+// mapping of a page holds another (see vma.c), so a page goes
+// back to the allocator once the segment and the last mapping
+// are both gone. The segment itself is counted by the open
+// files and the mappings that refer to it, and is freed, key
+// and all, with the last of them.
+//
+
+#include "types.h"
+#include "param.h"
+#include "riscv.h"
+#include "spinlock.h"
+#include "defs.h"
+#include "memstat.h"
+
+#define SHMMAXPG (PGSIZE / sizeof(char*)) // one page of page pointers
+
+struct shm {
+    int ref; // files and mappings referring to it; 0 if free
+    int key;
+    uint_t npages;
+    char** pages; // the pages, each 0 until first mapped
+};
+
+struct {
+    struct spinlock lock;
+    struct shm shm[NSHM];
+} shmtab;
+
+void shm_init(void)
+{
+    init_lock(&shmtab.lock, "shm");
+}
+
+// Find the segment named key, if key isn't 0, or make a new
+// one of size bytes, and return it with a reference held.
+// Returns 0 if the existing one is smaller than size, or if
+// out of segments or memory.
+struct shm*
+shm_get(int key, uint64_t size)
+{
+    struct shm *s, *free = 0;
+    char** pages;
+
+    if (size == 0 || size > SHMMAXPG * PGSIZE)
+        return 0;
+    if ((pages = k_alloc_zeroed()) == 0) // in case it's new
+        return 0;
+
+    acquire(&shmtab.lock);
+    for (s = shmtab.shm; s < &shmtab.shm[NSHM]; s++) {
+        if (s->ref == 0) {
+            if (free == 0)
+                free = s;
+        } else if (key != 0 && s->key == key) {
+            if (size > (uint64_t)s->npages * PGSIZE)
+                s = 0;
+            else
+                s->ref++;
+            release(&shmtab.lock);
+            k_free(pages);
+            return s;
+        }
+    }
+    if (free) {
+        free->ref = 1;
+        free->key = key;
+        free->npages = PGROUNDUP(size) / PGSIZE;
+        free->pages = pages;
+    } else {
+        k_free(pages);
+    }
+    release(&shmtab.lock);
+    return free;
+}
+
+void shm_dup(struct shm* s)
+{
+    acquire(&shmtab.lock);
+    if (s->ref < 1)
+        panic("shm_dup");
+    s->ref++;
+    release(&shmtab.lock);
+}
+
+// Drop a reference to s, and free it with the last one.
+void shm_put(struct shm* s)
+{
+    acquire(&shmtab.lock);
+    if (s->ref < 1)
+        panic("shm_put");
+    if (--s->ref > 0) {
+        release(&shmtab.lock);
+        return;
+    }
+    char** pages = s->pages;
+    uint_t npages = s->npages;
+    s->key = 0;
+    s->pages = 0;
+    release(&shmtab.lock);
+
+    for (uint_t i = 0; i < npages; i++) {
+        if (pages[i])
+            k_free(pages[i]);
+    }
+    k_free(pages);
+}
+
+// The size of s in bytes.
+uint64_t
+shm_size(struct shm* s)
+{
+    return (uint64_t)s->npages * PGSIZE;
+}
+
+// Return page pgno of s, with a reference held for the caller
+// (to be dropped with k_free()), allocating it if this is its
+// first use. Returns 0 if out of memory.
+char*
+shm_page(struct shm* s, uint_t pgno)
+{
+    char* pa;
+
+    if (pgno >= s->npages)
+        panic("shm_page");
+
+    acquire(&shmtab.lock);
+    if ((pa = s->pages[pgno]) != 0) {
+        k_ref_inc(pa);
+        release(&shmtab.lock);
+        return pa;
+    }
+    release(&shmtab.lock);
+
+    // allocate outside the lock, since k_alloc() may have to
+    // reclaim, and let whoever got there first win.
+    if ((pa = k_alloc_zeroed()) == 0)
+        return 0;
+    k_use(pa, MU_USER);
+    acquire(&shmtab.lock);
+    if (s->pages[pgno] == 0) {
+        s->pages[pgno] = pa;
+    } else {
+        k_free(pa);
+        pa = s->pages[pgno];
+    }
+    k_ref_inc(pa); // one for s, one for the caller
+    release(&shmtab.lock);
+    return pa;
+}
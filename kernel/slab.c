@@ -0,0 +1,194 @@
+// Object cache ("slab") allocator, on top of kalloc.c.
+//
+// Each kmem_cache hands out objects of one fixed size. Objects
+// are carved out of whole pages ("slabs") obtained from k_alloc();
+// a struct slab header sits at the start of each page, so the
+// slab that owns an object is found by rounding the object's
+// address down to a page boundary.
+//
+// Each hart keeps a magazine of up to MAGSIZE free objects per
+// cache. kmem_cache_alloc()/kmem_cache_free() only take the cache
+// lock to refill or flush half a magazine at a time.
+//
+// Usage:
+//   static struct kmem_cache file_cache;
+//   kmem_cache_init(&file_cache, "file", sizeof(struct file));
+//   f = kmem_cache_alloc(&file_cache);
+//   ...
+//   kmem_cache_free(&file_cache, f);
+
+#include "types.h"
+#include "param.h"
+#include "riscv.h"
+#include "spinlock.h"
+#include "slab.h"
+#include "defs.h"
+#include "memstat.h"
+
+// header at the start of every slab page.
+struct slab {
+    struct kmem_cache* cache; // owner
+    struct slab* next; // on cache->partial
+    struct slab* prev;
+    void* freelist; // free objects, linked through their first word
+    int inuse; // objects handed out, including those in magazines
+};
+
+#define SLABHDR ((sizeof(struct slab) + 15) & ~15)
+
+void kmem_cache_init(struct kmem_cache* c, char* name, uint_t size)
+{
+    // objects are 16-byte aligned and must be able to
+    // hold the freelist link.
+    size = (size + 15) & ~15;
+    if (size > PGSIZE - SLABHDR)
+        panic("kmem_cache_init: object too big");
+
+    init_lock(&c->lock, "kmem_cache");
+    c->name = name;
+    c->size = size;
+    c->perslab = (PGSIZE - SLABHDR) / size;
+    c->partial = 0;
+    c->nslabs = 0;
+    c->use = MU_KERNEL;
+    for (int i = 0; i < NCPU; i++)
+        c->mag[i].n = 0;
+}
+
+static void
+partial_push(struct kmem_cache* c, struct slab* s)
+{
+    s->prev = 0;
+    s->next = c->partial;
+    if (c->partial)
+        c->partial->prev = s;
+    c->partial = s;
+}
+
+static void
+partial_remove(struct kmem_cache* c, struct slab* s)
+{
+    if (s->prev)
+        s->prev->next = s->next;
+    else
+        c->partial = s->next;
+    if (s->next)
+        s->next->prev = s->prev;
+}
+
+// Carve a fresh page into objects.
+// Caller must hold c->lock.
+static struct slab*
+slab_grow(struct kmem_cache* c)
+{
+    struct slab* s = (struct slab*)k_alloc();
+    if (s == 0)
+        return 0;
+    k_use(s, c->use);
+
+    s->cache = c;
+    s->inuse = 0;
+    s->freelist = 0;
+    char* obj = (char*)s + SLABHDR + (c->perslab - 1) * c->size;
+    for (int i = 0; i < c->perslab; i++, obj -= c->size) {
+        *(void**)obj = s->freelist;
+        s->freelist = obj;
+    }
+    partial_push(c, s);
+    c->nslabs++;
+    return s;
+}
+
+// Take one object from the slabs.
+// Caller must hold c->lock.
+static void*
+slab_alloc(struct kmem_cache* c)
+{
+    struct slab* s = c->partial;
+    if (s == 0 && (s = slab_grow(c)) == 0)
+        return 0;
+
+    void* obj = s->freelist;
+    s->freelist = *(void**)obj;
+    s->inuse++;
+    if (s->freelist == 0)
+        partial_remove(c, s); // now full
+    return obj;
+}
+
+// Give one object back to its slab, and the slab's
+// page back to kalloc if it is now empty.
+// Caller must hold c->lock.
+static void
+slab_free(struct kmem_cache* c, void* obj)
+{
+    struct slab* s = (struct slab*)PGROUNDDOWN((uint64_t)obj);
+    if (s->cache != c)
+        panic("kmem_cache_free: wrong cache");
+
+    if (s->freelist == 0)
+        partial_push(c, s); // was full
+    *(void**)obj = s->freelist;
+    s->freelist = obj;
+    if (--s->inuse == 0) {
+        partial_remove(c, s);
+        c->nslabs--;
+        k_free((void*)s);
+    }
+}
+
+// Take one object from this hart's magazine of cache c,
+// refilling it from the slabs if empty.
+static void*
+cache_take(struct kmem_cache* c)
+{
+    void* obj = 0;
+
+    push_off();
+    struct magazine* m = &c->mag[cpu_id()];
+    if (m->n == 0) {
+        // refill half a magazine.
+        acquire(&c->lock);
+        while (m->n < MAGSIZE / 2) {
+            void* o = slab_alloc(c);
+            if (o == 0)
+                break;
+            m->objs[m->n++] = o;
+        }
+        release(&c->lock);
+    }
+    if (m->n > 0)
+        obj = m->objs[--m->n];
+    pop_off();
+
+    return obj;
+}
+
+// Allocate one object from cache c.
+// Returns 0 if out of memory. The object is not zeroed.
+void* kmem_cache_alloc(struct kmem_cache* c)
+{
+    void* obj;
+
+    // slab_grow() holds c->lock, so its k_alloc() can't swap
+    // pages out to make room; here, with the lock let go, we can.
+    if ((obj = cache_take(c)) == 0 && k_reclaim() > 0)
+        obj = cache_take(c);
+    return obj;
+}
+
+// Return obj, which came from kmem_cache_alloc(c), to cache c.
+void kmem_cache_free(struct kmem_cache* c, void* obj)
+{
+    push_off();
+    struct magazine* m = &c->mag[cpu_id()];
+    if (m->n == MAGSIZE) {
+        // flush half a magazine back to the slabs.
+        acquire(&c->lock);
+        while (m->n > MAGSIZE / 2)
+            slab_free(c, m->objs[--m->n]);
+        release(&c->lock);
+    }
+    m->objs[m->n++] = obj;
+    pop_off();
+}
@@ -0,0 +1,22 @@
+// Object cache ("slab") allocator for small kernel objects.
+// See slab.c.
+
+#define MAGSIZE 16 // objects per per-hart magazine
+
+// a per-hart stack of free objects, so that most
+// allocations and frees don't take the cache lock.
+struct magazine {
+    int n; // objects in objs[]
+    void* objs[MAGSIZE];
+};
+
+struct kmem_cache {
+    struct spinlock lock;
+    char* name; // for debugging
+    uint_t size; // object size in bytes, rounded up
+    uint_t perslab; // objects per slab page
+    struct slab* partial; // slabs with at least one free object
+    int nslabs; // slab pages owned by this cache
+    int use; // what the slab pages count as, MU_* (memstat.h)
+    struct magazine mag[NCPU]; // indexed by cpu_id()
+};
@@ -11,6 +11,12 @@ void timer_init();
 // entry.S needs one stack per CPU. 这个会在 entry.S 中使用
 __attribute__((aligned(16))) char stack0[4096 * NCPU];
 
+// a save area per hart for machinevec.
+uint64_t mscratch0[NCPU * 2];
+
+// in kernelvec.S, takes the machine-mode traps.
+void machinevec();
+
 // entry.S jumps here in machine mode on stack0.
 void start()
 {
@@ -27,8 +33,10 @@ void start()
     // disable paging for now.
     w_satp(0);
 
-    // delegate all interrupts and exceptions to supervisor mode.
-    w_medeleg(0xffff);
+    // delegate all interrupts and exceptions to supervisor mode,
+    // except an ecall from supervisor mode, which machinevec
+    // takes to interrupt another hart.
+    w_medeleg(0xffff & ~(1L << 9));
     w_mideleg(0xffff);
     w_sie(r_sie() | SIE_SEIE /* s-mode external(外设) interrupt enable */ | SIE_STIE /* timer */ | SIE_SSIE /* 软件中断 */);
 
@@ -41,6 +49,19 @@ void start()
     // ask for clock interrupts.
     timer_init();
 
+    // let other harts interrupt this one, to get it out of
+    // wfi (see kick() in sched.c).
+    w_mscratch((uint64_t)&mscratch0[r_mhartid() * 2]);
+    w_mtvec((uint64_t)machinevec);
+    w_mie(r_mie() | MIE_MSIE);
+
+#ifdef RVV
+    // is there a vector unit, for string.c? it stays off (VS 0)
+    // but while string.c's vector loops run.
+    if (r_misa() & (1L << ('V' - 'A')))
+        rvv = 1;
+#endif
+
     // keep each CPU's hartid in its tp register, for cpu_id().
     int id = r_mhartid();
     w_tp(id);
@@ -58,9 +79,13 @@ void timer_init()
     // enable the sstc extension (i.e. stimecmp).
     w_menvcfg(r_menvcfg() | (1L << 63));
 
-    // allow supervisor to use stimecmp and time.
-    w_mcounteren(r_mcounteren() | 2);
+    // allow supervisor to use stimecmp and time, and cycle
+    // (for kbench.c).
+    w_mcounteren(r_mcounteren() | 2 | 1);
+
+    // let user mode read time too (rdtime), for user/bench.c.
+    w_scounteren(r_scounteren() | 2);
 
     // ask for the very first timer interrupt.
-    w_stimecmp(r_time() + 1000000);
+    w_stimecmp(r_time() + TICK);
 }
@@ -1,12 +1,148 @@
 #include "types.h"
+#ifdef RVV
+#include "riscv.h"
+#include "defs.h"
+#endif
+
+//
+// memset(), memmove() and memcmp() work a word at a time, four
+// words per loop, wherever the pointers' alignment allows, since
+// they zero, copy and compare whole pages on hot paths. Built
+// with RVV=1, they use the vector extension instead on harts
+// that have it (start() sets rvv) for all but short strings.
+// Neither swtch() nor the trap frame saves vector registers, so
+// the vector loops run with interrupts off, and the vector unit
+// is only on (sstatus.VS) while they run: user code finds it off,
+// and a vector instruction there traps, rather than share the
+// registers with the kernel.
+//
+
+#define WORD (sizeof(uint64_t))
+#define ALIGNED(p, q) (((((uint64_t)(p)) ^ ((uint64_t)(q))) & (WORD - 1)) == 0)
+
+#ifdef RVV
+int rvv; // use the vector extension?
+#define RVV_MIN 256 // shorter isn't worth the vec_on()
+
+// turn the vector unit on, with interrupts off.
+static void
+vec_on(void)
+{
+    push_off();
+    w_sstatus(r_sstatus() | SSTATUS_VS_INITIAL);
+}
+
+// and off again.
+static void
+vec_off(void)
+{
+    w_sstatus(r_sstatus() & ~SSTATUS_VS);
+    pop_off();
+}
+
+static void
+vmemset(char* d, int c, uint64_t n)
+{
+    vec_on();
+    asm volatile(
+        ".option push\n"
+        ".option arch, +v\n"
+        "1: vsetvli t0, %1, e8, m8, ta, ma\n"
+        "vmv.v.x v8, %2\n"
+        "vse8.v v8, (%0)\n"
+        "add %0, %0, t0\n"
+        "sub %1, %1, t0\n"
+        "bnez %1, 1b\n"
+        ".option pop\n"
+        : "+r"(d), "+r"(n)
+        : "r"(c)
+        : "t0", "memory");
+    vec_off();
+}
+
+// copy forwards, which is right unless d overlaps the end of s.
+static void
+vmemcpy(char* d, const char* s, uint64_t n)
+{
+    vec_on();
+    asm volatile(
+        ".option push\n"
+        ".option arch, +v\n"
+        "1: vsetvli t0, %2, e8, m8, ta, ma\n"
+        "vle8.v v8, (%1)\n"
+        "vse8.v v8, (%0)\n"
+        "add %0, %0, t0\n"
+        "add %1, %1, t0\n"
+        "sub %2, %2, t0\n"
+        "bnez %2, 1b\n"
+        ".option pop\n"
+        : "+r"(d), "+r"(s), "+r"(n)
+        :
+        : "t0", "memory");
+    vec_off();
+}
+
+// the offset of the first difference, or n if none.
+static uint64_t
+vmemcmp(const uchar_t* a, const uchar_t* b, uint64_t n)
+{
+    uint64_t off = 0, i;
+
+    vec_on();
+    asm volatile(
+        ".option push\n"
+        ".option arch, +v\n"
+        "1: vsetvli t0, %2, e8, m8, ta, ma\n"
+        "vle8.v v8, (%3)\n"
+        "vle8.v v16, (%4)\n"
+        "vmsne.vv v0, v8, v16\n"
+        "vfirst.m %1, v0\n"
+        "bgez %1, 2f\n"
+        "add %0, %0, t0\n"
+        "add %3, %3, t0\n"
+        "add %4, %4, t0\n"
+        "sub %2, %2, t0\n"
+        "bnez %2, 1b\n"
+        "li %1, 0\n"
+        "2:\n"
+        ".option pop\n"
+        : "+r"(off), "=&r"(i), "+r"(n), "+r"(a), "+r"(b)
+        :
+        : "t0", "memory");
+    vec_off();
+    return off + i;
+}
+#endif
 
 void* memset(void* dst, int c, uint_t n)
 {
     char* cdst = (char*)dst;
-    int i;
-    for (i = 0; i < n; i++) {
-        cdst[i] = c;
+
+#ifdef RVV
+    if (rvv && n >= RVV_MIN) {
+        vmemset(cdst, c, n);
+        return dst;
     }
+#endif
+    if (n >= 2 * WORD) {
+        uint64_t w = (uchar_t)c * 0x0101010101010101UL;
+        while ((uint64_t)cdst & (WORD - 1)) {
+            *cdst++ = c;
+            n--;
+        }
+        uint64_t* wdst = (uint64_t*)cdst;
+        for (; n >= 4 * WORD; n -= 4 * WORD, wdst += 4) {
+            wdst[0] = w;
+            wdst[1] = w;
+            wdst[2] = w;
+            wdst[3] = w;
+        }
+        for (; n >= WORD; n -= WORD)
+            *wdst++ = w;
+        cdst = (char*)wdst;
+    }
+    while (n-- > 0)
+        *cdst++ = c;
     return dst;
 }
 
@@ -16,6 +152,24 @@ int memcmp(const void* v1, const void* v2, uint_t n)
 
     s1 = v1;
     s2 = v2;
+#ifdef RVV
+    if (rvv && n >= RVV_MIN) {
+        uint64_t i = vmemcmp(s1, s2, n);
+        return i == n ? 0 : s1[i] - s2[i];
+    }
+#endif
+    if (n >= 2 * WORD && ALIGNED(s1, s2)) {
+        while ((uint64_t)s1 & (WORD - 1)) {
+            if (*s1 != *s2)
+                return *s1 - *s2;
+            s1++, s2++, n--;
+        }
+        // skip the equal words; the bytes find the difference.
+        for (; n >= WORD; n -= WORD, s1 += WORD, s2 += WORD) {
+            if (*(uint64_t*)s1 != *(uint64_t*)s2)
+                break;
+        }
+    }
     while (n-- > 0) {
         if (*s1 != *s2)
             return *s1 - *s2;
@@ -36,10 +190,58 @@ void* memmove(void* dst, const void* src, uint_t n)
     s = src;
     d = dst;
     if (s < d && s + n > d) {
+        // overlapping, d above s: copy backwards.
         s += n;
         d += n;
+        if (n >= 2 * WORD && ALIGNED(s, d)) {
+            while ((uint64_t)d & (WORD - 1)) {
+                *--d = *--s;
+                n--;
+            }
+            uint64_t* dw = (uint64_t*)d;
+            const uint64_t* sw = (const uint64_t*)s;
+            for (; n >= 4 * WORD; n -= 4 * WORD) {
+                dw -= 4;
+                sw -= 4;
+                uint64_t w3 = sw[3], w2 = sw[2], w1 = sw[1], w0 = sw[0];
+                dw[3] = w3;
+                dw[2] = w2;
+                dw[1] = w1;
+                dw[0] = w0;
+            }
+            for (; n >= WORD; n -= WORD)
+                *--dw = *--sw;
+            d = (char*)dw;
+            s = (const char*)sw;
+        }
         while (n-- > 0)
             *--d = *--s;
+#ifdef RVV
+    } else if (rvv && n >= RVV_MIN) {
+        vmemcpy(d, s, n);
+#endif
+    } else if (n >= 2 * WORD && ALIGNED(s, d)) {
+        // equally aligned: bytes up to a word boundary, then
+        // words, four at a time while there are that many.
+        while ((uint64_t)d & (WORD - 1)) {
+            *d++ = *s++;
+            n--;
+        }
+        uint64_t* dw = (uint64_t*)d;
+        const uint64_t* sw = (const uint64_t*)s;
+        for (; n >= 4 * WORD; n -= 4 * WORD, dw += 4, sw += 4) {
+            uint64_t w0 = sw[0], w1 = sw[1], w2 = sw[2], w3 = sw[3];
+            dw[0] = w0;
+            dw[1] = w1;
+            dw[2] = w2;
+            dw[3] = w3;
+        }
+        for (; n >= WORD; n -= WORD)
+            *dw++ = *sw++;
+        d = (char*)dw;
+        s = (const char*)sw;
+        while (n-- > 0)
+            *d++ = *s++;
     } else
         while (n-- > 0)
             *d++ = *s++;
@@ -0,0 +1,270 @@
+//
+// Swapping user pages out to disk.
+//
+// When memory runs low, swap_out() moves cold user pages into
+// the swap area, SWAPSIZE blocks of the disk just past the file
+// system, so that allocations succeed instead of failing: k_alloc()
+// and kmem_cache_alloc() call swap_reclaim() (through k_reclaim())
+// when out of memory if their caller can sleep, and fork(),
+// exec() and spawn(), parts of which allocate holding spinlocks,
+// call it and retry when they fail. The
+// PTE of a page in swap has PTE_V clear and PTE_SWAP set, keeps
+// its permission bits, and holds the swap slot number in place
+// of the physical page number; the next touch of the page faults
+// and vma_fault() reads it back with swap_in(). fork() shares a
+// slot between parent and child, so slots carry a reference
+// count just as physical pages do.
+//
+// Pages are chosen with the clock (second-chance) algorithm: a
+// hand sweeps over the processes' memory, and a page that was
+// touched since the last sweep (PTE_A, set by the hardware) has
+// the bit cleared and is passed over once. Only pages of the
+// heap, stack and program that no one else maps are taken, and
+// only from processes that are stopped where nothing can be
+// using or changing their page tables, as p->swappable says:
+// preempted in user mode, or asleep in sleep(2), or waiting for
+// a pipe, the console or a child in sleep_user(). Other sleeps,
+// for the disk or a sleeplock, can be in the middle of changing
+// the page table (e.g. swap_in() and vma_fill() hold a PTE or a
+// page not yet mapped) and are left alone. A megapage that wasn't
+// touched is split, and its pages go one at a time.
+//
+// One swap-out or swap-in at a time, under swap.io.
+//
+
+#include "types.h"
+#include "param.h"
+#include "memlayout.h"
+#include "riscv.h"
+#include "spinlock.h"
+#include "sleeplock.h"
+#include "proc.h"
+#include "defs.h"
+#include "fs.h"
+#include "buf.h"
+#include "memstat.h"
+
+#define BPP (PGSIZE / BSIZE) // blocks per page
+#define NSLOT (SWAPSIZE / BPP)
+#define SWAPLOW 64 // swap_reclaim() only below this many free pages
+#define SWAPBATCH 64 // pages per swap_reclaim()
+#define SWAPSCAN 8192 // PTEs looked at per swap_out(), at most
+
+extern struct proc procs[NPROC];
+
+struct {
+    struct spinlock lock; // protects ref[] and the counters
+    uchar_t ref[NSLOT]; // references to each slot, 0 if free
+    uint64_t nused;
+    uint64_t nin; // pages read back in
+    uint64_t nout; // pages written out
+
+    struct sleeplock io; // one page of I/O at a time, through buf[]
+    struct buf buf[BPP];
+
+    // the clock hand.
+    int hand_p; // index into procs[]
+    uint64_t hand_va;
+} swap;
+
+void swap_init(void)
+{
+    init_lock(&swap.lock, "swap");
+    initsleeplock(&swap.io, "swapio");
+}
+
+static int
+slot_alloc(void)
+{
+    acquire(&swap.lock);
+    for (int s = 0; s < NSLOT; s++) {
+        if (swap.ref[s] == 0) {
+            swap.ref[s] = 1;
+            swap.nused++;
+            release(&swap.lock);
+            return s;
+        }
+    }
+    release(&swap.lock);
+    return -1;
+}
+
+// Another PTE refers to slot s (fork()).
+void swap_dup(int s)
+{
+    acquire(&swap.lock);
+    if (swap.ref[s] == 0 || swap.ref[s] == 255)
+        panic("swap_dup");
+    swap.ref[s]++;
+    release(&swap.lock);
+}
+
+// A PTE referring to slot s is gone.
+void swap_free(int s)
+{
+    acquire(&swap.lock);
+    if (swap.ref[s] == 0)
+        panic("swap_free");
+    if (--swap.ref[s] == 0)
+        swap.nused--;
+    release(&swap.lock);
+}
+
+// Read or write the page in slot s from or to swap.buf[].
+// Caller must hold swap.io.
+static void
+slot_rw(int s, int write)
+{
+    for (int i = 0; i < BPP; i++) {
+        struct buf* b = &swap.buf[i];
+        b->dev = ROOTDEV;
+        b->blockno = FSSIZE + s * BPP + i;
+        virtio_disk_rw(b, write);
+    }
+}
+
+// Bring the page of pte, which is in swap, back into memory.
+// Caller must be the process the page table belongs to.
+// Returns 0, or -1 if out of memory.
+int swap_in(pte_t* pte)
+{
+    char* mem;
+    int s;
+
+    if ((mem = k_alloc()) == 0)
+        return -1;
+    k_use(mem, MU_USER);
+
+    s = PTE2SLOT(*pte);
+    acquiresleep(&swap.io);
+    slot_rw(s, 0);
+    for (int i = 0; i < BPP; i++)
+        memmove(mem + i * BSIZE, swap.buf[i].data, BSIZE);
+    releasesleep(&swap.io);
+
+    *pte = PA2PTE(mem) | (PTE_FLAGS(*pte) & ~PTE_SWAP) | PTE_A | PTE_V;
+    swap_free(s);
+
+    acquire(&swap.lock);
+    swap.nin++;
+    release(&swap.lock);
+    return 0;
+}
+
+// May the clock hand take p's pages? Caller holds p->lock.
+static int
+swappable(struct proc* p)
+{
+    return p->swappable && (p->state == RUNNABLE || p->state == SLEEPING);
+}
+
+// Look at the page of p at the hand, and advance the hand.
+// If the page is cold, copy it into swap.buf[] and swap its PTE
+// out to a new slot, returned; else return -1. Caller holds
+// p->lock and swap.io.
+static int
+clock_step(struct proc* p)
+{
+    uint64_t va = swap.hand_va;
+    pte_t* pte;
+    int s;
+
+    swap.hand_va += PGSIZE;
+
+    pte = walk_level(p->pagetable, va, 1, 0);
+    if (pte == 0 || (*pte & PTE_V) == 0) {
+        swap.hand_va = MEGAPGROUNDDOWN(va) + MEGAPGSIZE; // nothing there
+        return -1;
+    }
+    if (PTE_LEAF(*pte)) {
+        if (*pte & PTE_A) {
+            *pte &= ~PTE_A;
+            tlb_invalidate(p, MEGAPGROUNDDOWN(va), -1); // so A gets set again
+            swap.hand_va = MEGAPGROUNDDOWN(va) + MEGAPGSIZE;
+            return -1;
+        }
+        // cold: split it, so the pages can go one at a time.
+        if (demote(pte) != 0) {
+            swap.hand_va = MEGAPGROUNDDOWN(va) + MEGAPGSIZE;
+            return -1;
+        }
+    }
+
+    pte = walk(p->pagetable, va, 0);
+    if (pte == 0 || (*pte & PTE_V) == 0 || (*pte & PTE_U) == 0)
+        return -1;
+    if (*pte & PTE_A) {
+        *pte &= ~PTE_A; // second chance
+        tlb_invalidate(p, va, 1);
+        return -1;
+    }
+    char* pa = (char*)PTE2PA(*pte);
+    if (k_ref_count(pa) != 1)
+        return -1; // shared: copy-on-write, or the page cache's
+    if ((s = slot_alloc()) < 0)
+        return -1;
+
+    for (int i = 0; i < BPP; i++)
+        memmove(swap.buf[i].data, pa + i * BSIZE, BSIZE);
+    *pte = SLOT2PTE(s) | (PTE_FLAGS(*pte) & ~PTE_V) | PTE_SWAP;
+    tlb_invalidate(p, va, 1);
+    k_free(pa);
+    p->swapped = 1;
+    return s;
+}
+
+// Write up to n cold user pages out to swap and free them.
+// Returns the number of pages freed.
+int swap_out(int n)
+{
+    int nout = 0, s;
+
+    acquiresleep(&swap.io);
+    for (int scan = 0; scan < SWAPSCAN && nout < n; scan++) {
+        struct proc* p = &procs[swap.hand_p];
+
+        acquire(&p->lock);
+        if (!swappable(p) || swap.hand_va >= p->sz) {
+            release(&p->lock);
+            swap.hand_p = (swap.hand_p + 1) % NPROC;
+            swap.hand_va = 0;
+            continue;
+        }
+        s = clock_step(p);
+        release(&p->lock);
+
+        if (s >= 0) {
+            // the PTE already says the page is in slot s; a fault
+            // on it waits in swap_in() for swap.io.
+            slot_rw(s, 1);
+            nout++;
+        }
+    }
+    releasesleep(&swap.io);
+
+    acquire(&swap.lock);
+    swap.nout += nout;
+    release(&swap.lock);
+    return nout;
+}
+
+// Called where it's safe to sleep, before or after an allocation
+// fails: if memory is short, swap some pages out.
+// Returns the number of pages freed.
+int swap_reclaim(void)
+{
+    if (k_nfree() >= SWAPLOW || holdingsleep(&swap.io))
+        return 0;
+    return swap_out(SWAPBATCH);
+}
+
+// Fill in the swap fields of st.
+void swap_memstat(struct memstat* st)
+{
+    acquire(&swap.lock);
+    st->nswap = NSLOT;
+    st->nswapused = swap.nused;
+    st->nswapin = swap.nin;
+    st->nswapout = swap.nout;
+    release(&swap.lock);
+}
@@ -96,6 +96,14 @@ extern uint64_t sys_unlink(void);
 extern uint64_t sys_link(void);
 extern uint64_t sys_mkdir(void);
 extern uint64_t sys_close(void);
+extern uint64_t sys_memstat(void);
+extern uint64_t sys_mmap(void);
+extern uint64_t sys_munmap(void);
+extern uint64_t sys_shmget(void);
+extern uint64_t sys_pstat(void);
+extern uint64_t sys_spawn(void);
+extern uint64_t sys_setpriority(void);
+extern uint64_t sys_getpriority(void);
 
 // An array mapping syscall numbers from syscall.h
 // to the function that handles the system call.
@@ -121,6 +129,14 @@ static uint64_t (*syscalls[])(void) = {
     [SYS_link] sys_link,
     [SYS_mkdir] sys_mkdir,
     [SYS_close] sys_close,
+    [SYS_memstat] sys_memstat,
+    [SYS_mmap] sys_mmap,
+    [SYS_munmap] sys_munmap,
+    [SYS_shmget] sys_shmget,
+    [SYS_pstat] sys_pstat,
+    [SYS_spawn] sys_spawn,
+    [SYS_setpriority] sys_setpriority,
+    [SYS_getpriority] sys_getpriority,
 };
 
 void syscall(void)
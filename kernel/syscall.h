@@ -20,3 +20,11 @@
 #define SYS_link 19
 #define SYS_mkdir 20
 #define SYS_close 21
+#define SYS_memstat 22
+#define SYS_mmap 23
+#define SYS_munmap 24
+#define SYS_shmget 25
+#define SYS_pstat 26
+#define SYS_spawn 27
+#define SYS_setpriority 28
+#define SYS_getpriority 29
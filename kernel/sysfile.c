@@ -15,6 +15,7 @@
 #include "sleeplock.h"
 #include "file.h"
 #include "fcntl.h"
+#include "mman.h"
 
 // Fetch the nth word-sized system call argument as a file descriptor
 // and return both the descriptor and the corresponding struct file.
@@ -429,46 +430,97 @@ uint64_t sys_chdir(void)
     return 0;
 }
 
-uint64_t sys_exec(void)
+// Fetch the user argument vector at uargv into argv[MAXARG],
+// a page per string. Returns 0, or -1 if it is bad or too
+// long. Either way, free the strings with freeargv().
+static int
+fetchargv(uint64_t uargv, char** argv)
 {
-    char path[MAXPATH], *argv[MAXARG];
-    int i;
-    uint64_t uargv, uarg;
+    uint64_t uarg;
 
-    argaddr(1, &uargv);
-    if (argstr(0, path, MAXPATH) < 0) {
-        return -1;
-    }
-    memset(argv, 0, sizeof(argv));
-    for (i = 0;; i++) {
-        if (i >= NELEM(argv)) {
-            goto bad;
+    memset(argv, 0, MAXARG * sizeof(char*));
+    for (int i = 0;; i++) {
+        if (i >= MAXARG) {
+            return -1;
         }
         if (fetchaddr(uargv + sizeof(uint64_t) * i, (uint64_t*)&uarg) < 0) {
-            goto bad;
+            return -1;
         }
         if (uarg == 0) {
             argv[i] = 0;
-            break;
+            return 0;
         }
         argv[i] = k_alloc();
         if (argv[i] == 0)
-            goto bad;
+            return -1;
         if (fetchstr(uarg, argv[i], PGSIZE) < 0)
-            goto bad;
+            return -1;
     }
+}
 
-    int ret = exec(path, argv);
-
-    for (i = 0; i < NELEM(argv) && argv[i] != 0; i++)
+static void
+freeargv(char** argv)
+{
+    for (int i = 0; i < MAXARG && argv[i] != 0; i++)
         k_free(argv[i]);
+}
+
+uint64_t sys_exec(void)
+{
+    char path[MAXPATH], *argv[MAXARG];
+    uint64_t uargv;
+    int ret = -1;
 
+    argaddr(1, &uargv);
+    if (argstr(0, path, MAXPATH) < 0) {
+        return -1;
+    }
+    if (fetchargv(uargv, argv) == 0) {
+        ret = exec(path, argv);
+        if (ret < 0 && swap_reclaim() > 0)
+            ret = exec(path, argv); // out of memory, maybe not any more
+    }
+    freeargv(argv);
     return ret;
+}
 
-bad:
-    for (i = 0; i < NELEM(argv) && argv[i] != 0; i++)
-        k_free(argv[i]);
-    return -1;
+// int spawn(char* path, char** argv, int fds[3])
+// run path in a new child whose descriptors 0-2 are the
+// caller's fds[0-2], or absent where fds[i] is -1; if fds is
+// 0, the caller's own 0-2. Returns the child's pid.
+uint64_t
+sys_spawn(void)
+{
+    char path[MAXPATH], *argv[MAXARG];
+    uint64_t uargv, ufds;
+    int fds[3] = { 0, 1, 2 };
+    struct file* files[3];
+    struct proc* p = my_proc();
+    int ret = -1;
+
+    argaddr(1, &uargv);
+    argaddr(2, &ufds);
+    if (argstr(0, path, MAXPATH) < 0) {
+        return -1;
+    }
+    if (ufds != 0 && copyin(p->pagetable, (char*)fds, ufds, sizeof(fds)) < 0) {
+        return -1;
+    }
+    for (int i = 0; i < 3; i++) {
+        files[i] = 0;
+        if (fds[i] >= 0 && fds[i] < NOFILE)
+            files[i] = p->ofile[fds[i]];
+        if (files[i] == 0 && ufds != 0 && fds[i] != -1)
+            return -1; // not open
+    }
+
+    if (fetchargv(uargv, argv) == 0) {
+        ret = spawn(path, argv, files);
+        if (ret < 0 && swap_reclaim() > 0)
+            ret = spawn(path, argv, files);
+    }
+    freeargv(argv);
+    return ret;
 }
 
 uint64_t
@@ -499,3 +551,86 @@ sys_pipe(void)
     }
     return 0;
 }
+
+// void* mmap(void* addr, uint64_t len, int prot, int flags, int fd, int off)
+// addr is only a hint, and ignored.
+uint64_t
+sys_mmap(void)
+{
+    uint64_t len;
+    int prot, flags, off, perm;
+    struct file* f;
+    struct inode* ip = 0;
+
+    argaddr(1, &len);
+    argint(2, &prot);
+    argint(3, &flags);
+    argint(5, &off);
+
+    if ((prot & PROT_READ) == 0 || (prot & ~(PROT_READ | PROT_WRITE | PROT_EXEC)) != 0)
+        return -1;
+    if ((flags & ~MAP_ANONYMOUS) != MAP_SHARED && (flags & ~MAP_ANONYMOUS) != MAP_PRIVATE)
+        return -1;
+    perm = PTE_R;
+    if (prot & PROT_WRITE)
+        perm |= PTE_W;
+    if (prot & PROT_EXEC)
+        perm |= PTE_X;
+
+    if ((flags & MAP_ANONYMOUS) == 0) {
+        if (argfd(4, 0, &f) < 0)
+            return -1;
+        if (f->type == FD_SHM) {
+            if ((flags & MAP_SHARED) == 0 || off < 0 || off % PGSIZE != 0)
+                return -1;
+            return vma_mmap(my_proc(), len, perm, MAP_SHARED, 0, f->shm, off);
+        }
+        if (f->type != FD_INODE || !f->readable)
+            return -1;
+        if ((flags & MAP_SHARED) && (prot & PROT_WRITE) && !f->writable)
+            return -1;
+        if (off < 0 || off % PGSIZE != 0)
+            return -1;
+        ip = f->ip;
+    }
+    return vma_mmap(my_proc(), len, perm, flags & ~MAP_ANONYMOUS, ip, 0, off);
+}
+
+// int shmget(int key, uint64_t size)
+// Returns a descriptor for the shared memory segment named key
+// (a new one if key is 0), to be mapped with mmap(MAP_SHARED).
+uint64_t
+sys_shmget(void)
+{
+    int key, fd;
+    uint64_t size;
+    struct shm* s;
+    struct file* f;
+
+    argint(0, &key);
+    argaddr(1, &size);
+    if ((s = shm_get(key, size)) == 0)
+        return -1;
+    if ((f = file_alloc()) == 0 || (fd = fdalloc(f)) < 0) {
+        if (f)
+            fileclose(f);
+        shm_put(s);
+        return -1;
+    }
+    f->type = FD_SHM;
+    f->readable = 1;
+    f->writable = 1;
+    f->shm = s;
+    return fd;
+}
+
+// int munmap(void* addr, uint64_t len)
+uint64_t
+sys_munmap(void)
+{
+    uint64_t addr, len;
+
+    argaddr(0, &addr);
+    argaddr(1, &len);
+    return vma_munmap(my_proc(), addr, len);
+}
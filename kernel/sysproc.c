@@ -5,6 +5,7 @@
 #include "memlayout.h"
 #include "spinlock.h"
 #include "proc.h"
+#include "memstat.h"
 
 uint64_t
 sys_exit(void)
@@ -24,7 +25,11 @@ sys_getpid(void)
 uint64_t
 sys_fork(void)
 {
-    return fork();
+    int pid;
+
+    if ((pid = fork()) < 0 && swap_reclaim() > 0)
+        pid = fork(); // out of memory, maybe not any more
+    return pid;
 }
 
 uint64_t
@@ -58,14 +63,19 @@ sys_sleep(void)
     if (n < 0)
         n = 0;
     acquire(&tickslock);
+    ticks_update();
     ticks0 = ticks;
+    my_proc()->swappable = 1; // not touching user memory
     while (ticks - ticks0 < n) {
         if (killed(my_proc())) {
+            my_proc()->swappable = 0;
             release(&tickslock);
             return -1;
         }
+        timer_wake_at(ticks0 + n);
         sleep(&ticks, &tickslock);
     }
+    my_proc()->swappable = 0;
     release(&tickslock);
     return 0;
 }
@@ -87,7 +97,66 @@ sys_uptime(void)
     uint_t xticks;
 
     acquire(&tickslock);
+    ticks_update();
     xticks = ticks;
     release(&tickslock);
     return xticks;
 }
+
+// copy physical memory statistics to the
+// user struct memstat at the address in a0.
+uint64_t
+sys_memstat(void)
+{
+    uint64_t addr;
+    struct memstat st;
+
+    argaddr(0, &addr);
+    k_memstat(&st);
+    swap_memstat(&st);
+    bio_memstat(&st);
+    if (copyout(my_proc()->pagetable, addr, (char*)&st, sizeof(st)) < 0)
+        return -1;
+    return 0;
+}
+
+// int setpriority(int pid, int nice)
+uint64_t
+sys_setpriority(void)
+{
+    int pid, nice;
+
+    argint(0, &pid);
+    argint(1, &nice);
+    return setnice(pid, nice);
+}
+
+// int getpriority(int pid, int* nice)
+uint64_t
+sys_getpriority(void)
+{
+    int pid, nice;
+    uint64_t addr;
+
+    argint(0, &pid);
+    argaddr(1, &addr);
+    if (getnice(pid, &nice) < 0)
+        return -1;
+    if (copyout(my_proc()->pagetable, addr, (char*)&nice, sizeof(nice)) < 0)
+        return -1;
+    return 0;
+}
+
+// int pstat(struct pstat* ps, int n)
+// copy statistics for up to n processes to the user array
+// ps; returns how many.
+uint64_t
+sys_pstat(void)
+{
+    uint64_t addr;
+    int n;
+
+    argaddr(0, &addr);
+    argint(1, &n);
+    return proc_stat(addr, n);
+}
@@ -6,9 +6,19 @@
 #include "proc.h"
 #include "defs.h"
 
+// ticks counts the TICKs of the time CSR since reset. The
+// timer interrupts come once a tick while a hart has a process
+// to run, but an idle hart skips them (timer_idle()), so ticks
+// comes from the clock rather than from how many there were.
+// Whichever hart's timer goes off brings it up to date, as do
+// sys_sleep() and sys_uptime() before they look at it.
 struct spinlock tickslock;
 uint_t ticks;
 
+// the tick the first sys_sleep() is waiting for, if wake_set.
+static uint_t wake_tick;
+static int wake_set;
+
 extern char trampoline[], uservec[], userret[];
 
 // in kernelvec.S, calls kerneltrap().
@@ -64,6 +74,25 @@ void usertrap(void)
         syscall();
     } else if ((which_dev = devintr()) != 0) {
         // ok
+    } else if (r_scause() == 12 || r_scause() == 13 || r_scause() == 15) {
+        // page fault: maybe on a lazily allocated, demand-paged
+        // or copy-on-write page. bringing it in may read a file
+        // and sleep, so, as for a system call, enable interrupts
+        // once done with the trap registers.
+        uint64_t scause = r_scause();
+        uint64_t stval = r_stval();
+        int access = scause == 15 ? FAULT_STORE : scause == 12 ? FAULT_FETCH : FAULT_LOAD;
+        intr_on();
+        swap_reclaim(); // keep some memory free, for this and the kernel
+        if (vma_fault(p, stval, access) == 0
+            && (swap_reclaim() == 0 || vma_fault(p, stval, access) == 0)) {
+            // a bad address, or out of memory even after swapping.
+            printf("usertrap(): unexpected scause 0x%lx pid=%d\n", scause, p->pid);
+            printf("            sepc=0x%lx stval=0x%lx\n", p->trap_frame->epc, stval);
+            setkilled(p);
+        } else {
+            tlb_flush_page(p, stval);
+        }
     } else {
         printf("usertrap(): unexpected scause 0x%lx pid=%d\n", r_scause(), p->pid);
         printf("            sepc=0x%lx stval=0x%lx\n", r_sepc(), r_stval());
@@ -73,9 +102,14 @@ void usertrap(void)
     if (killed(p))
         exit(-1);
 
-    // give up the CPU if this is a timer interrupt.
-    if (which_dev == 2)
+    // give up the CPU if the time slice is over, or a process
+    // that should run first is waiting (see sched.c). stopped in
+    // user mode, the process can have its pages swapped out.
+    if (sched_preempt(which_dev == 2)) {
+        p->swappable = 1;
         yield();
+        p->swappable = 0;
+    }
 
     usertrapret();
 }
@@ -98,7 +132,11 @@ void usertrapret(void)
 
     // set up trap_frame values that uservec will need when
     // the process next traps into the kernel.
+#ifdef SHAREKVM
+    p->trap_frame->kernel_satp = 0; // stay on the user page table
+#else
     p->trap_frame->kernel_satp = r_satp(); // kernel page table
+#endif
     p->trap_frame->kernel_sp = p->kstack + PGSIZE; // process's kernel stack
     p->trap_frame->kernel_trap = (uint64_t)usertrap;
     p->trap_frame->kernel_hartid = r_tp(); // hartid for cpu_id()
@@ -115,8 +153,15 @@ void usertrapret(void)
     // set S Exception Program Counter to the saved user pc.
     w_sepc(p->trap_frame->epc);
 
-    // tell trampoline.S the user page table to switch to.
-    uint64_t satp = MAKE_SATP(p->pagetable);
+    // tell trampoline.S the user page table to switch to,
+    // or, with SHAREKVM, switch to it here (it maps this code)
+    // and tell trampoline.S not to.
+#ifdef SHAREKVM
+    kvm_switch(p);
+    uint64_t satp = 0;
+#else
+    uint64_t satp = asid_satp(p);
+#endif
 
     // jump to userret in trampoline.S at the top of memory, which
     // switches to the user page table, restores user registers,
@@ -145,8 +190,9 @@ void kerneltrap()
         panic("kerneltrap");
     }
 
-    // give up the CPU if this is a timer interrupt.
-    if (which_dev == 2 && my_proc() != 0)
+    // give up the CPU if the time slice is over, or a process
+    // that should run first has just been woken.
+    if (my_proc() != 0 && sched_preempt(which_dev == 2))
         yield();
 
     // the yield() may have caused some traps to occur,
@@ -155,19 +201,68 @@ void kerneltrap()
     w_sstatus(sstatus);
 }
 
+// Bring ticks up to date with the clock, and wake up the
+// sleepers if it moved. Caller must hold tickslock.
+void ticks_update(void)
+{
+    uint_t now = r_time() / TICK;
+
+    // another hart may have got there first.
+    if ((int)(now - ticks) > 0) {
+        ticks = now;
+        wake_set = 0; // the sleepers will say again
+        wakeup(&ticks);
+    }
+}
+
 void clockintr()
 {
-    if (cpu_id() == 0) {
+    uint_t now = r_time() / TICK;
+
+    if (now != ticks) {
         acquire(&tickslock);
-        ticks++;
-        wakeup(&ticks);
+        ticks_update();
         release(&tickslock);
     }
 
-    // ask for the next timer interrupt. this also clears
-    // the interrupt request. 1000000 is about a tenth
-    // of a second.
-    w_stimecmp(r_time() + 1000000);
+    // ask for the next timer interrupt, at the start of the
+    // next tick. this also clears the interrupt request.
+    w_stimecmp((uint64_t)(now + 1) * TICK);
+}
+
+// A sleeper on &ticks wants to be woken by tick t.
+// Caller must hold tickslock.
+void timer_wake_at(uint_t t)
+{
+    if (!wake_set || (int)(t - wake_tick) < 0) {
+        wake_tick = t;
+        wake_set = 1;
+    }
+}
+
+// This hart has nothing to run and is about to wait for an
+// interrupt: rather than every tick, have its timer go off only
+// when the first sleeper is due, if there is one. A hart that
+// is running a process keeps on ticking, and catches sleepers
+// that fall due in the meantime.
+void timer_idle(void)
+{
+    uint64_t when = -1; // never
+    acquire(&tickslock);
+    if (wake_set)
+        when = (uint64_t)wake_tick * TICK;
+    release(&tickslock);
+    w_stimecmp(when);
+}
+
+// This hart may be about to run a process: make sure its timer
+// goes off within a tick, to preempt it.
+void timer_busy(void)
+{
+    uint64_t next = (r_time() / TICK + 1) * TICK;
+
+    if (r_stimecmp() > next)
+        w_stimecmp(next);
 }
 
 // check if it's an external interrupt or software interrupt,
@@ -199,6 +294,11 @@ int devintr()
         if (irq)
             plic_complete(irq);
 
+        return 1;
+    } else if (scause == 0x8000000000000001L) {
+        // software interrupt, from another hart's kick() via
+        // machinevec, to get this one out of wfi.
+        w_sip(r_sip() & ~2);
         return 1;
     } else if (scause == 0x8000000000000005L) {
         // timer interrupt.
@@ -5,11 +5,26 @@
 #include "riscv.h"
 #include "defs.h"
 #include "fs.h"
+#include "spinlock.h"
+#include "proc.h"
+#include "memstat.h"
+#include "pstat.h"
 
 /*
  * the kernel's page table.
  */
 pagetable_t kernel_pagetable;
+int asid_max; // largest ASID the hardware has, 0 if none (see asid_satp())
+
+#define MEGAORDER 9 // k_try_order() of a megapage
+
+// with SHAREKVM, the kernel's mappings are the same in every
+// page table, so may as well be global.
+#ifdef SHAREKVM
+#define PTE_KG PTE_G
+#else
+#define PTE_KG 0
+#endif
 
 /**
  * @brief kernel.ld sets this to end of kernel code. (end of text)
@@ -22,24 +37,24 @@ extern char trampoline[]; // trampoline.S // 这个地址在 kernel.ld 中被确
 // Make a direct-map page table for the kernel.
 pagetable_t k_vm_make(void)
 {
-    pagetable_t k_pg_tbl = (pagetable_t)k_alloc(); // 从空闲链表中拿出一个 page
-    memset(k_pg_tbl, 0, PGSIZE);
+    pagetable_t k_pg_tbl = (pagetable_t)k_alloc_zeroed(); // 从空闲链表中拿出一个 page
+    k_use(k_pg_tbl, MU_PGTBL);
 
     // uart registers
-    k_vm_map(k_pg_tbl, UART0, UART0, PGSIZE, PTE_R | PTE_W);
+    k_vm_map(k_pg_tbl, UART0, UART0, PGSIZE, PTE_R | PTE_W | PTE_KG);
 
     // virtio mmio disk interface
-    k_vm_map(k_pg_tbl, VIRTIO0, VIRTIO0, PGSIZE, PTE_R | PTE_W);
+    k_vm_map(k_pg_tbl, VIRTIO0, VIRTIO0, PGSIZE, PTE_R | PTE_W | PTE_KG);
 
     // PLIC
-    k_vm_map(k_pg_tbl, PLIC, PLIC, 0x4000000, PTE_R | PTE_W);
+    k_vm_map(k_pg_tbl, PLIC, PLIC, 0x4000000, PTE_R | PTE_W | PTE_KG);
 
     /* ---------- 直接映射: kernel text ---------- */
 
     // map kernel text executable and read-only.
-    k_vm_map(k_pg_tbl, KERNBASE, KERNBASE, (uint64_t)etext - KERNBASE, PTE_R | PTE_X);
+    k_vm_map(k_pg_tbl, KERNBASE, KERNBASE, (uint64_t)etext - KERNBASE, PTE_R | PTE_X | PTE_KG);
     // map kernel data and the physical RAM we'll make use of.
-    k_vm_map(k_pg_tbl, (uint64_t)etext, (uint64_t)etext, PHYSTOP - (uint64_t)etext, PTE_R | PTE_W);
+    k_vm_map(k_pg_tbl, (uint64_t)etext, (uint64_t)etext, PHYSTOP - (uint64_t)etext, PTE_R | PTE_W | PTE_KG);
 
     /* ---------- 跳板: 虚拟最高映射到: 0x0x80001000 ---------- */
 
@@ -53,10 +68,39 @@ pagetable_t k_vm_make(void)
     return k_pg_tbl;
 }
 
+// Count the page-table pages of the level-level table pagetable
+// and below, and the megapage leaves among their PTEs.
+static void
+kvm_count(pagetable_t pagetable, int level, int* ntables, int* nmega)
+{
+    (*ntables)++;
+    for (int i = 0; i < 512; i++) {
+        pte_t pte = pagetable[i];
+        if ((pte & PTE_V) == 0)
+            continue;
+        if (!PTE_LEAF(pte))
+            kvm_count((pagetable_t)PTE2PA(pte), level - 1, ntables, nmega);
+        else if (level == 1)
+            (*nmega)++;
+    }
+}
+
 // Initialize the one kernel_pagetable
 void kvm_init(void)
 {
+    int ntables = 0, nmega = 0;
+
     kernel_pagetable = k_vm_make();
+#ifdef SHAREKVM
+    // kvm_share() hands out these level-2 and level-1 entries.
+    if (PX(2, PHYSTOP - 1) != PX(2, KERNBASE) || PX(2, VIRTIO0) != PX(2, PLIC)
+        || PX(2, KERNBASE) == PX(2, PLIC) || (KERNBASE >> 30) + 1 != (MMAPBASE >> 30))
+        panic("kvm_init: layout");
+#endif
+
+    // each megapage stands in for a level-0 page-table page.
+    kvm_count(kernel_pagetable, 2, &ntables, &nmega);
+    printf("kvm_init: %d page-table pages, %d saved by megapages\n", ntables, nmega);
 }
 
 // Switch h/w page table register to the kernel's page table,
@@ -66,15 +110,178 @@ void kvm_init_hart()
     // wait for any previous writes to the page table memory to finish.
     sfence_vma();
 
-    w_satp(MAKE_SATP(kernel_pagetable));
+    // the ASID field holds as many bits as the hardware
+    // implements, and reads back zero in the others.
+    w_satp(MAKE_SATP(kernel_pagetable, 0) | SATP_ASID_MASK);
+#ifndef NOASID
+    asid_max = (r_satp() & SATP_ASID_MASK) >> SATP_ASID_SHIFT;
+#endif
+    w_satp(MAKE_SATP(kernel_pagetable, 0));
 
     // flush stale entries from the TLB.
     sfence_vma();
 }
 
+//
+// Address-space IDs.
+//
+// Each hart hands out ASIDs to the processes that run on it,
+// 1, 2, ..., asid_max, and the kernel's page table has ASID 0,
+// so that switching satp between them leaves their entries in
+// the TLB. When a hart runs out, it starts a new generation:
+// flushes its TLB and makes every ASID it handed out stale.
+//
+// A process's TLB entries on harts other than the one it runs
+// on can't be flushed from here (there are no TLB shootdown
+// IPIs), so when its page table loses a mapping the process
+// drops its ASIDs on those harts instead, and gets fresh ones,
+// with no entries, if it runs there again.
+//
+// Without ASIDs (asid_max 0, or built with NOASID=1) every
+// process runs with ASID 0 and trampoline.S flushes the TLB on
+// each switch, as it used to.
+//
+
+#define TLB_NPAGES 16 // more than this, flush the whole ASID
+
+// The satp value that runs p on this hart, allocating an ASID
+// if it has none here. Called with interrupts off.
+uint64_t asid_satp(struct proc* p)
+{
+    struct cpu* c = my_cpu();
+    struct asid* a = &p->asids[cpu_id()];
+
+    if (asid_max == 0)
+        return MAKE_SATP(p->pagetable, 0);
+
+    if (a->gen != c->asid_gen || c->asid_gen == 0) {
+        if (c->asid_gen == 0 || c->asid_next > asid_max) {
+            c->asid_gen++;
+            c->asid_next = 1;
+            sfence_vma();
+        }
+        a->id = c->asid_next++;
+        a->gen = c->asid_gen;
+    }
+    return MAKE_SATP(p->pagetable, a->id);
+}
+
+// p's page table no longer maps [va, va+npages*PGSIZE) the way
+// it did, or (npages -1) has changed all over: flush p's entries
+// for it on this hart and drop p's ASIDs on the others. p must
+// not be running on another hart.
+void tlb_invalidate(struct proc* p, uint64_t va, uint64_t npages)
+{
+    push_off();
+    int id = cpu_id();
+    for (int i = 0; i < NCPU; i++) {
+        if (i != id)
+            p->asids[i].gen = 0;
+    }
+    struct asid* a = &p->asids[id];
+    if (asid_max == 0) {
+#ifdef SHAREKVM
+        sfence_vma(); // the trampoline won't
+#endif
+    } else if (a->gen == my_cpu()->asid_gen) {
+        if (npages <= TLB_NPAGES) {
+            for (uint64_t i = 0; i < npages; i++)
+                sfence_vma_page(va + i * PGSIZE, a->id);
+        } else {
+            sfence_vma_asid(a->id);
+        }
+    }
+    pop_off();
+}
+
+// Flush this hart's entry for va in p's address space, after a
+// page fault made the page present or writable: the hart may
+// have cached the old PTE, and would fault on it again.
+void tlb_flush_page(struct proc* p, uint64_t va)
+{
+    push_off();
+    struct asid* a = &p->asids[cpu_id()];
+    if (asid_max == 0) {
+#ifdef SHAREKVM
+        sfence_vma();
+#endif
+    } else if (a->gen == my_cpu()->asid_gen) {
+        sfence_vma_page(PGROUNDDOWN(va), a->id);
+    }
+    pop_off();
+}
+
+//
+// Kernel mappings in user page tables.
+//
+// With SHAREKVM=1, every user page table maps the kernel too,
+// at the same addresses and with global PTEs, so that traps
+// and system calls run on the process's page table and the
+// trampoline doesn't switch satp at all. The satp switch moves
+// to the scheduler: a hart that stops running a process goes
+// back to the kernel's own page table (kvm_switch()), so that
+// the process's can be freed, and usertrapret() switches to
+// the next. Kernel stacks are used through the direct map, as
+// KSTACK() is user address space here, and so have no guard
+// pages.
+//
+
+#ifdef SHAREKVM
+// Map the kernel into the user page table pagetable: the RAM
+// by sharing the kernel's level-1 page-table page for it, the
+// devices by copying the kernel's level-1 PTEs for them into
+// the user's. Returns 0, or -1 if out of memory.
+int kvm_share(pagetable_t pagetable)
+{
+    pagetable_t kdev = (pagetable_t)PTE2PA(kernel_pagetable[PX(2, PLIC)]);
+    pte_t* pte;
+
+    for (uint64_t va = PLIC; va <= VIRTIO0; va += MEGAPGSIZE) {
+        if ((pte = walk_level(pagetable, va, 1, 1)) == 0)
+            return -1;
+        *pte = kdev[PX(1, va)];
+    }
+    pagetable[PX(2, KERNBASE)] = kernel_pagetable[PX(2, KERNBASE)];
+    return 0;
+}
+
+// Take the kernel's entries back out of pagetable, which is
+// about to be freed, so freewalk() leaves them alone.
+void kvm_unshare(pagetable_t pagetable)
+{
+    pte_t* pte;
+
+    for (uint64_t va = PLIC; va <= VIRTIO0; va += MEGAPGSIZE) {
+        if ((pte = walk_level(pagetable, va, 1, 0)) != 0)
+            *pte = 0;
+    }
+    pagetable[PX(2, KERNBASE)] = 0;
+}
+#endif
+
+// Switch this hart to p's page table, or to the kernel's own
+// if p is 0. Only with SHAREKVM does the kernel run on user
+// page tables; otherwise trampoline.S does the switching.
+// Switching to p must be done with interrupts off.
+void kvm_switch(struct proc* p)
+{
+#ifdef SHAREKVM
+    uint64_t satp = p ? asid_satp(p) : MAKE_SATP(kernel_pagetable, 0);
+
+    if (r_satp() == satp)
+        return;
+    w_satp(satp);
+    if ((satp & SATP_ASID_MASK) == 0)
+        sfence_vma(); // the previous page table's entries, untagged
+#endif
+}
+
 // Return the address of the PTE in page table pagetable
-// that corresponds to virtual address va.  If alloc!=0,
-// create any required page-table pages.
+// that corresponds to virtual address va at the given level:
+// 0 for a 4 KiB page, 1 for a 2 MiB megapage. If alloc!=0,
+// create any required page-table pages. If va is already
+// covered by a leaf at a higher level (a megapage), return
+// that leaf's PTE instead.
 //
 // The risc-v Sv39 scheme has three levels of page-table
 // pages. A page-table page contains 512 64-bit PTEs.
@@ -84,28 +291,56 @@ void kvm_init_hart()
 //   21..29 -- 9 bits of level-1 index.
 //   12..20 -- 9 bits of level-0 index.
 //    0..11 -- 12 bits of byte offset within the page.
-pte_t* walk(pagetable_t pagetable, uint64_t va, int alloc)
+pte_t* walk_level(pagetable_t pagetable, uint64_t va, int level, int alloc)
 {
     if (va >= MAXVA) {
         panic("walk");
     }
 
-    for (int level = 2; level > 0; level--) {
-        pte_t* pte = &pagetable[PX(level, va)]; // 取出一个 pte
+    for (int l = 2; l > level; l--) {
+        pte_t* pte = &pagetable[PX(l, va)]; // 取出一个 pte
         if (*pte & PTE_V) {
+            if (PTE_LEAF(*pte))
+                return pte; // va is in a megapage
             pagetable = (pagetable_t)PTE2PA(*pte);
         } else {
-            if (!alloc || (pagetable = (pde_t*)k_alloc()) == 0) {
+            // 分配空的 page
+            if (!alloc || (pagetable = (pde_t*)k_alloc_zeroed()) == 0) {
                 // 如果不分配: !alloc
                 // 或者 k_alloc == NULL, k_alloc 是从空闲链表上面取下一个节点
                 return 0;
             }
-            // 分配空的 page
-            memset(pagetable, 0, PGSIZE);
+            k_use(pagetable, MU_PGTBL);
             *pte = PA2PTE(pagetable) | PTE_V;
         }
     }
-    return &pagetable[PX(0, va)];
+    return &pagetable[PX(level, va)];
+}
+
+// Return the address of the leaf PTE that maps va: the
+// level-0 PTE, or the level-1 PTE if va is in a megapage.
+// If alloc!=0, create any required page-table pages.
+pte_t* walk(pagetable_t pagetable, uint64_t va, int alloc)
+{
+    return walk_level(pagetable, va, 0, alloc);
+}
+
+// Like walk(pagetable, va, 0), but also report the level of
+// the leaf: 1 if va is in a megapage, else 0. Returns 0 if
+// there is no level-0 page-table page for va.
+static pte_t*
+walk_leaf(pagetable_t pagetable, uint64_t va, int* level)
+{
+    pte_t* pte = walk_level(pagetable, va, 1, 0);
+
+    *level = 0;
+    if (pte == 0 || (*pte & PTE_V) == 0)
+        return 0;
+    if (PTE_LEAF(*pte)) {
+        *level = 1;
+        return pte;
+    }
+    return &((pagetable_t)PTE2PA(*pte))[PX(0, va)];
 }
 
 // Look up a virtual address, return the physical address,
@@ -143,6 +378,11 @@ void k_vm_map(pagetable_t k_pg_tbl, uint64_t va, uint64_t pa, uint64_t sz, int p
 // Create PTEs for virtual addresses starting at va that refer to
 // physical addresses starting at pa.
 // va and size MUST be page-aligned.
+// Wherever va and pa are both 2 MiB aligned and at least 2 MiB
+// remain, a single level-1 leaf maps the whole megapage, which
+// saves a page-table page and covers 512 times as much memory
+// per TLB entry. In practice that's the kernel's direct map;
+// user memory is mapped a page at a time.
 // Returns 0 on success, -1 if walk() couldn't
 // allocate a needed page-table page.
 int map_pages(pagetable_t pagetable, uint64_t va, uint64_t size, uint64_t pa, int perm)
@@ -159,60 +399,136 @@ int map_pages(pagetable_t pagetable, uint64_t va, uint64_t size, uint64_t pa, in
     }
 
     uint64_t a = va;
-    uint64_t last = va + size - PGSIZE;
-    while (1) {
-        pte_t* pte;
-        if ((pte = walk(pagetable, a, 1)) == 0 /* 没空间了 */) {
+    uint64_t end = va + size;
+    while (a < end) {
+        pte_t* pte = 0;
+        uint64_t n = PGSIZE;
+        if (a % MEGAPGSIZE == 0 && pa % MEGAPGSIZE == 0 && end - a >= MEGAPGSIZE) {
+            if ((pte = walk_level(pagetable, a, 1, 1)) == 0)
+                return -1;
+            if ((*pte & PTE_V) == 0 || PTE_LEAF(*pte))
+                n = MEGAPGSIZE;
+            else
+                pte = 0; // some 4 KiB pages are there already
+        }
+        if (pte == 0 && (pte = walk(pagetable, a, 1)) == 0 /* 没空间了 */) {
             return -1;
         }
         if (*pte & PTE_V) {
             panic("map_pages: remap");
         }
         *pte = PA2PTE(pa) | perm | PTE_V;
-        if (a == last) {
-            break; // 死循环的出口
-        }
-        a += PGSIZE;
-        pa += PGSIZE;
+        a += n;
+        pa += n;
     }
     return 0;
 }
 
+// Split the user megapage mapped by the level-1 leaf *pte into
+// 512 4 KiB PTEs with the same flags, in a new level-0 page-table
+// page, so that part of it can be unmapped or shared.
+// Returns 0 on success, -1 if out of memory.
+int demote(pte_t* pte)
+{
+    uint64_t pa = PTE2PA(*pte);
+    int flags = PTE_FLAGS(*pte);
+    pagetable_t pt;
+
+    if ((pt = (pagetable_t)k_alloc()) == 0)
+        return -1;
+    k_use(pt, MU_PGTBL);
+    for (int i = 0; i < 512; i++)
+        pt[i] = PA2PTE(pa + i * PGSIZE) | flags;
+    k_split((void*)pa, MEGAORDER);
+    *pte = PA2PTE(pt) | PTE_V;
+    return 0;
+}
+
+// If a megapage is mapped at a, which isn't 2 MiB-aligned,
+// split it, so that the pages on either side of a can go
+// separately. Returns 0, or -1 if out of memory.
+static int
+split_at(pagetable_t pagetable, uint64_t a)
+{
+    pte_t* pte;
+    int level;
+
+    if (a % MEGAPGSIZE == 0 || a >= MAXVA)
+        return 0;
+    if ((pte = walk_leaf(pagetable, a, &level)) == 0 || level != 1)
+        return 0;
+    return demote(pte);
+}
+
 // Remove npages of mappings starting from va. va must be
-// page-aligned. The mappings must exist.
-// Optionally free the physical memory.
-void uvm_unmap(pagetable_t pagetable, uint64_t va, uint64_t npages, int do_free)
+// page-aligned. Pages that were never faulted in (see
+// uvm_fault()) are skipped. do_free is 0 to leave the physical
+// memory alone, or 1 to free it. A megapage that is only partly
+// in the range is split first, which may fail for want of a
+// page-table page; then nothing is unmapped and -1 is returned.
+// do_free is UVM_TEARDOWN instead for a page table that is going
+// away: such a megapage is freed whole, and this can't fail.
+// The current process's stale TLB entries are flushed; other
+// page tables are either not in use or dealt with by the caller.
+int uvm_unmap(pagetable_t pagetable, uint64_t va, uint64_t npages, int do_free)
 {
-    uint64_t a;
+    uint64_t a, end;
     pte_t* pte;
+    int level;
+    struct proc* p = my_proc();
 
     if ((va % PGSIZE) != 0)
         panic("uvm_unmap: not aligned");
 
-    for (a = va; a < va + npages * PGSIZE; a += PGSIZE) {
-        if ((pte = walk(pagetable, a, 0)) == 0)
-            panic("uvm_unmap: walk");
+    end = va + npages * PGSIZE;
+
+    // only the megapages at the two ends can be partly in range.
+    if (do_free != UVM_TEARDOWN && (split_at(pagetable, va) != 0 || split_at(pagetable, end) != 0))
+        return -1;
+
+    for (a = va; a < end; a += PGSIZE) {
+        if ((pte = walk_leaf(pagetable, a, &level)) == 0)
+            continue; // no page-table page, so not mapped
+        if (*pte & PTE_SWAP) {
+            if (do_free)
+                swap_free(PTE2SLOT(*pte));
+            *pte = 0;
+            continue;
+        }
         if ((*pte & PTE_V) == 0)
-            panic("uvm_unmap: not mapped");
+            continue; // lazily allocated, never touched
         if (PTE_FLAGS(*pte) == PTE_V)
             panic("uvm_unmap: not a leaf");
+        if (level == 1) {
+            if (do_free != UVM_TEARDOWN && (a % MEGAPGSIZE != 0 || end - a < MEGAPGSIZE))
+                panic("uvm_unmap: megapage");
+            if (do_free)
+                k_free_order((void*)PTE2PA(*pte), MEGAORDER);
+            *pte = 0;
+            a = MEGAPGROUNDDOWN(a) + MEGAPGSIZE - PGSIZE;
+            continue;
+        }
         if (do_free) {
             uint64_t pa = PTE2PA(*pte);
             k_free((void*)pa);
         }
         *pte = 0;
     }
+
+    if (p != 0 && p->pagetable == pagetable)
+        tlb_invalidate(p, va, npages);
+    return 0;
 }
 
 // create an empty user page table.
 // returns 0 if out of memory.
 pagetable_t uvm_create()
 {
-    pagetable_t pagetable = (pagetable_t)k_alloc();
+    pagetable_t pagetable = (pagetable_t)k_alloc_zeroed();
     if (pagetable == 0) {
         return 0;
     }
-    memset(pagetable, 0, PGSIZE);
+    k_use(pagetable, MU_PGTBL);
     return pagetable;
 }
 
@@ -225,8 +541,8 @@ void uvm_first(pagetable_t pagetable, uchar_t* src, uint_t sz)
 
     if (sz >= PGSIZE)
         panic("uvm_first: more than a page");
-    mem = k_alloc();
-    memset(mem, 0, PGSIZE);
+    mem = k_alloc_zeroed();
+    k_use(mem, MU_USER);
     map_pages(pagetable, 0, PGSIZE, (uint64_t)mem, PTE_W | PTE_R | PTE_X | PTE_U);
     memmove(mem, src, sz);
 }
@@ -243,12 +559,12 @@ uint64_t uvm_alloc(pagetable_t pagetable, uint64_t oldsz, uint64_t newsz, int xp
 
     oldsz = PGROUNDUP(oldsz);
     for (a = oldsz; a < newsz; a += PGSIZE) {
-        mem = k_alloc();
+        mem = k_alloc_zeroed();
         if (mem == 0) {
             uvmdealloc(pagetable, a, oldsz);
             return 0;
         }
-        memset(mem, 0, PGSIZE);
+        k_use(mem, MU_USER);
         if (map_pages(pagetable, a, PGSIZE, (uint64_t)mem, PTE_R | PTE_U | xperm) != 0) {
             k_free(mem);
             uvmdealloc(pagetable, a, oldsz);
@@ -261,7 +577,8 @@ uint64_t uvm_alloc(pagetable_t pagetable, uint64_t oldsz, uint64_t newsz, int xp
 // Deallocate user pages to bring the process size from oldsz to
 // newsz.  oldsz and newsz need not be page-aligned, nor does newsz
 // need to be less than oldsz.  oldsz can be larger than the actual
-// process size.  Returns the new process size.
+// process size.  Returns the new process size, or oldsz if a
+// megapage had to be split and there was no memory to do so.
 uint64_t
 uvmdealloc(pagetable_t pagetable, uint64_t oldsz, uint64_t newsz)
 {
@@ -269,8 +586,11 @@ uvmdealloc(pagetable_t pagetable, uint64_t oldsz, uint64_t newsz)
         return oldsz;
 
     if (PGROUNDUP(newsz) < PGROUNDUP(oldsz)) {
+        // fails if a megapage that the new end cuts in two
+        // can't be split.
         int npages = (PGROUNDUP(oldsz) - PGROUNDUP(newsz)) / PGSIZE;
-        uvm_unmap(pagetable, PGROUNDUP(newsz), npages, 1);
+        if (uvm_unmap(pagetable, PGROUNDUP(newsz), npages, 1) != 0)
+            return oldsz;
     }
 
     return newsz;
@@ -300,45 +620,240 @@ void freewalk(pagetable_t pagetable)
 void uvmfree(pagetable_t pagetable, uint64_t sz)
 {
     if (sz > 0)
-        uvm_unmap(pagetable, 0, PGROUNDUP(sz) / PGSIZE, 1);
+        uvm_unmap(pagetable, 0, PGROUNDUP(sz) / PGSIZE, UVM_TEARDOWN);
     freewalk(pagetable);
 }
 
+// Count into ps the pages of the level-level table pagetable and
+// below: resident user pages, pages in swap, and the page-table
+// pages themselves. kpt is the kernel's table for the same range,
+// or 0; entries that are the kernel's own (see kvm_share()) are
+// not the process's memory. The process may be changing its page
+// table meanwhile, so only follow pointers into RAM; the counts
+// are a snapshot at best.
+static void
+uvm_count(pagetable_t pagetable, pagetable_t kpt, int level, struct pstat* ps)
+{
+    ps->npt++;
+    for (int i = 0; i < 512; i++) {
+        pte_t pte = pagetable[i];
+        pte_t kpte = kpt ? kpt[i] : 0;
+        if (pte == 0 || pte == kpte)
+            continue;
+        if ((pte & PTE_V) == 0) {
+            if (pte & PTE_SWAP)
+                ps->nswap++;
+        } else if (PTE_LEAF(pte)) {
+            if (pte & PTE_U)
+                ps->rss += 1L << (9 * level); // a megapage is 512
+        } else if (level > 0 && PTE2PA(pte) >= KERNBASE && PTE2PA(pte) < PHYSTOP) {
+            pagetable_t kchild = 0;
+            if ((kpte & PTE_V) && !PTE_LEAF(kpte))
+                kchild = (pagetable_t)PTE2PA(kpte);
+            uvm_count((pagetable_t)PTE2PA(pte), kchild, level - 1, ps);
+        }
+    }
+}
+
+// Fill in the memory fields of ps for the user page table
+// pagetable.
+void uvm_stat(pagetable_t pagetable, struct pstat* ps)
+{
+    ps->rss = ps->nswap = ps->npt = 0;
+    if (pagetable)
+        uvm_count(pagetable, kernel_pagetable, 2, ps);
+}
+
 // Given a parent process's page table, copy
 // its memory into a child's page table.
-// Copies both the page table and the
-// physical memory.
+// Copies only the page table: the physical pages are
+// shared, and writable ones are made read-only in both
+// parent and child and marked PTE_COW, so that the first
+// store to them from either side copies the page
+// (see cow_fault()).
 // returns 0 on success, -1 on failure.
 // frees any allocated pages on failure.
 int uvmcopy(pagetable_t old, pagetable_t new, uint64_t sz)
+{
+    return uvmcopy_range(old, new, 0, sz, 0);
+}
+
+// Give new the pages of old in [start, end), as uvmcopy() does,
+// or, if shared is set, the very same pages with the same
+// permissions (for mmap(MAP_SHARED) regions). new's PTEs start
+// out clean and unaccessed: its stores are its own, for
+// vma_writeback().
+int uvmcopy_range(pagetable_t old, pagetable_t new, uint64_t start, uint64_t end, int shared)
 {
     pte_t* pte;
     uint64_t pa, i;
     uint_t flags;
-    char* mem;
-
-    for (i = 0; i < sz; i += PGSIZE) {
-        if ((pte = walk(old, i, 0)) == 0)
-            panic("uvmcopy: pte should exist");
+    int level;
+
+    for (i = start; i < end; i += PGSIZE) {
+        if ((pte = walk_leaf(old, i, &level)) == 0)
+            continue; // lazily allocated, never touched
+        if (*pte & PTE_SWAP) {
+            // the child shares the swap slot.
+            pte_t* npte = walk(new, i, 1);
+            if (npte == 0)
+                goto err;
+            *npte = *pte;
+            swap_dup(PTE2SLOT(*pte));
+            continue;
+        }
         if ((*pte & PTE_V) == 0)
-            panic("uvmcopy: page not present");
+            continue;
+        if (level == 1) {
+            // share megapages copy-on-write a 4 KiB page at a time.
+            if (demote(pte) != 0)
+                goto err;
+            pte = walk(old, i, 0);
+        }
+        if ((*pte & PTE_W) && !shared) {
+            *pte = (*pte & ~PTE_W) | PTE_COW;
+        }
         pa = PTE2PA(*pte);
-        flags = PTE_FLAGS(*pte);
-        if ((mem = k_alloc()) == 0)
-            goto err;
-        memmove(mem, (char*)pa, PGSIZE);
-        if (map_pages(new, i, PGSIZE, (uint64_t)mem, flags) != 0) {
-            k_free(mem);
+        flags = PTE_FLAGS(*pte) & ~(PTE_D | PTE_A);
+        if (map_pages(new, i, PGSIZE, pa, flags) != 0) {
             goto err;
         }
+        k_ref_inc((void*)pa);
     }
     return 0;
 
 err:
-    uvm_unmap(new, 0, i / PGSIZE, 1);
+    uvm_unmap(new, start, (i - start) / PGSIZE, 1);
     return -1;
 }
 
+// Resolve a store to a copy-on-write page at va:
+// give the faulting page table its own writable copy,
+// or simply make the page writable again if nobody
+// else shares it any more.
+// Returns 0 on success, -1 if va is not a COW page
+// or there is no memory for the copy.
+static int
+cow_fault(pagetable_t pagetable, uint64_t va)
+{
+    pte_t* pte;
+    uint64_t pa;
+    char* mem;
+
+    if (va >= MAXVA)
+        return -1;
+    va = PGROUNDDOWN(va);
+    pte = walk(pagetable, va, 0);
+    if (pte == 0 || (*pte & PTE_V) == 0 || (*pte & PTE_U) == 0 || (*pte & PTE_COW) == 0)
+        return -1;
+
+    pa = PTE2PA(*pte);
+    if (k_ref_count((void*)pa) == 1) {
+        // the other sharers have gone; take the page over.
+        *pte = (*pte | PTE_W) & ~PTE_COW;
+        return 0;
+    }
+
+    if ((mem = k_alloc()) == 0)
+        return -1;
+    k_use(mem, MU_USER);
+    memmove(mem, (char*)pa, PGSIZE);
+    *pte = PA2PTE(mem) | ((PTE_FLAGS(*pte) | PTE_W) & ~PTE_COW);
+    k_free((void*)pa); // drop this page table's reference
+
+    // another hart may still map va to the old page.
+    struct proc* p = my_proc();
+    if (p != 0 && p->pagetable == pagetable)
+        tlb_invalidate(p, va, 1);
+    return 0;
+}
+
+// Make the user page holding va present, and allow access
+// (FAULT_LOAD, FAULT_STORE or FAULT_FETCH) to it, on a page fault
+// or before copyin()/copyout() touch it:
+//  - a page below sz that was never touched gets a fresh
+//    zeroed page, since sbrk() grows the heap lazily;
+//  - a store to a copy-on-write page gets its own copy.
+// Returns the physical address of the page,
+// or 0 if va is not a legal user address for this access.
+uint64_t uvm_fault(pagetable_t pagetable, uint64_t va, uint64_t sz, int access)
+{
+    pte_t* pte;
+    char* mem;
+    int level;
+
+    if (va >= MAXVA)
+        return 0;
+    va = PGROUNDDOWN(va);
+
+    pte = walk_leaf(pagetable, va, &level);
+    if (pte != 0 && (*pte & PTE_V) != 0) {
+        if ((*pte & PTE_U) == 0)
+            return 0; // e.g. the stack guard page
+        if (access == FAULT_STORE && (*pte & PTE_W) == 0) {
+            if ((*pte & PTE_COW) == 0 || cow_fault(pagetable, va) != 0)
+                return 0;
+        } else if ((*pte & FAULT_PERM(access)) == 0) {
+            return 0; // e.g. a jump into the heap
+        }
+        if (level == 1)
+            return PTE2PA(*pte) + (va & (MEGAPGSIZE - 1));
+        return PTE2PA(*pte);
+    }
+
+    // not mapped: part of the lazily grown heap, which isn't
+    // executable?
+    if (va >= sz || access == FAULT_FETCH || (pte != 0 && (*pte & PTE_SWAP)))
+        return 0; // swap_in() is vma_fault()'s job
+    if ((mem = k_alloc_zeroed()) == 0)
+        return 0;
+    k_use(mem, MU_USER);
+    if (map_pages(pagetable, va, PGSIZE, (uint64_t)mem, PTE_R | PTE_W | PTE_U) != 0) {
+        k_free(mem);
+        return 0;
+    }
+    return (uint64_t)mem;
+}
+
+// Back the whole 2 MiB-aligned region around va with a single
+// zeroed megapage, if nothing in the region is mapped yet and
+// an aligned, physically contiguous block is free as it is
+// (k_try_order(), no draining the hart caches). Megapages
+// mean fewer page-table pages and TLB misses for big heaps.
+// The caller must know that the region is all lazily grown heap.
+// Returns 0 on success, -1 to fall back to 4 KiB pages.
+int uvm_megapage(pagetable_t pagetable, uint64_t va)
+{
+    pte_t* pte;
+    char* mem;
+
+    if ((pte = walk_level(pagetable, MEGAPGROUNDDOWN(va), 1, 1)) == 0)
+        return -1;
+    if (*pte & PTE_V)
+        return -1; // some of it is already mapped
+    if ((mem = k_try_order(MEGAORDER)) == 0)
+        return -1;
+    k_use(mem, MU_USER);
+    memset(mem, 0, MEGAPGSIZE);
+    *pte = PA2PTE(mem) | PTE_R | PTE_W | PTE_U | PTE_V;
+    return 0;
+}
+
+// Fault in the user page holding va for copyin()/copyout(),
+// as the hardware would for the process that owns pagetable,
+// if it is the current process (see vma_fault()). Any other
+// page table (e.g. exec's new one) is always fully mapped.
+static uint64_t
+user_fault(pagetable_t pagetable, uint64_t va, int write)
+{
+    struct proc* p = my_proc();
+    int access = write ? FAULT_STORE : FAULT_LOAD;
+
+    if (p != 0 && p->pagetable == pagetable)
+        return vma_fault(p, va, access);
+    return uvm_fault(pagetable, va, 0, access);
+}
+
 // mark a PTE invalid for user access.
 // used by exec for the user stack guard page.
 void uvmclear(pagetable_t pagetable, uint64_t va)
@@ -351,30 +866,45 @@ void uvmclear(pagetable_t pagetable, uint64_t va)
     *pte &= ~PTE_U;
 }
 
+// Translate user address va for a copy of up to len bytes,
+// faulting it in as user_fault() does. Returns the kernel
+// address of va and sets *n to how many of the len bytes are
+// there contiguously: to the end of the page, or of the
+// megapage if va is in one, so that one look-up serves 2 MiB.
+// Returns 0 if va isn't a legal user address for the access.
+static char*
+user_span(pagetable_t pagetable, uint64_t va, uint64_t len, int write, uint64_t* n)
+{
+    uint64_t va0 = PGROUNDDOWN(va), pa0, end;
+    int level;
+
+    if ((pa0 = user_fault(pagetable, va0, write)) == 0)
+        return 0;
+    end = va0 + PGSIZE;
+    if (len > end - va && walk_leaf(pagetable, va0, &level) != 0 && level == 1)
+        end = MEGAPGROUNDDOWN(va) + MEGAPGSIZE;
+    *n = end - va < len ? end - va : len;
+    return (char*)(pa0 + (va - va0));
+}
+
 // Copy from kernel to user.
 // Copy len bytes from src to virtual address dstva in a given page table.
 // Return 0 on success, -1 on error.
 int copyout(pagetable_t pagetable, uint64_t dstva, char* src, uint64_t len)
 {
-    uint64_t n, va0, pa0;
-    pte_t* pte;
+    uint64_t n;
+    char* dst;
 
     while (len > 0) {
-        va0 = PGROUNDDOWN(dstva);
-        if (va0 >= MAXVA)
+        // fault the page in, and break copy-on-write
+        // sharing, as a user store would.
+        if ((dst = user_span(pagetable, dstva, len, 1, &n)) == 0)
             return -1;
-        pte = walk(pagetable, va0, 0);
-        if (pte == 0 || (*pte & PTE_V) == 0 || (*pte & PTE_U) == 0 || (*pte & PTE_W) == 0)
-            return -1;
-        pa0 = PTE2PA(*pte);
-        n = PGSIZE - (dstva - va0);
-        if (n > len)
-            n = len;
-        memmove((void*)(pa0 + (dstva - va0)), src, n);
+        memmove(dst, src, n);
 
         len -= n;
         src += n;
-        dstva = va0 + PGSIZE;
+        dstva += n;
     }
     return 0;
 }
@@ -384,63 +914,58 @@ int copyout(pagetable_t pagetable, uint64_t dstva, char* src, uint64_t len)
 // Return 0 on success, -1 on error.
 int copyin(pagetable_t pagetable, char* dst, uint64_t srcva, uint64_t len)
 {
-    uint64_t n, va0, pa0;
+    uint64_t n;
+    char* src;
 
     while (len > 0) {
-        va0 = PGROUNDDOWN(srcva);
-        pa0 = walk_addr(pagetable, va0);
-        if (pa0 == 0)
+        if ((src = user_span(pagetable, srcva, len, 0, &n)) == 0)
             return -1;
-        n = PGSIZE - (srcva - va0);
-        if (n > len)
-            n = len;
-        memmove(dst, (void*)(pa0 + (srcva - va0)), n);
+        memmove(dst, src, n);
 
         len -= n;
         dst += n;
-        srcva = va0 + PGSIZE;
+        srcva += n;
     }
     return 0;
 }
 
+// does the word w have a zero byte?
+#define HASZERO(w) (((w) - 0x0101010101010101UL) & ~(w) & 0x8080808080808080UL)
+
 // Copy a null-terminated string from user to kernel.
 // Copy bytes to dst from virtual address srcva in a given page table,
 // until a '\0', or max.
 // Return 0 on success, -1 on error.
 int copyinstr(pagetable_t pagetable, char* dst, uint64_t srcva, uint64_t max)
 {
-    uint64_t n, va0, pa0;
-    int got_null = 0;
+    uint64_t n;
+    char* p;
 
-    while (got_null == 0 && max > 0) {
-        va0 = PGROUNDDOWN(srcva);
-        pa0 = walk_addr(pagetable, va0);
-        if (pa0 == 0)
+    while (max > 0) {
+        if ((p = user_span(pagetable, srcva, max, 0, &n)) == 0)
             return -1;
-        n = PGSIZE - (srcva - va0);
-        if (n > max)
-            n = max;
-
-        char* p = (char*)(pa0 + (srcva - va0));
-        while (n > 0) {
-            if (*p == '\0') {
-                *dst = '\0';
-                got_null = 1;
-                break;
-            } else {
-                *dst = *p;
+        srcva += n;
+        max -= n;
+
+        // a word at a time while p and dst are aligned alike and
+        // the word has no NUL; the bytes of the last one below.
+        if ((((uint64_t)p ^ (uint64_t)dst) & 7) == 0) {
+            while (((uint64_t)p & 7) && n > 0) {
+                if ((*dst++ = *p++) == '\0')
+                    return 0;
+                n--;
+            }
+            for (; n >= 8; n -= 8, p += 8, dst += 8) {
+                uint64_t w = *(uint64_t*)p;
+                if (HASZERO(w))
+                    break;
+                *(uint64_t*)dst = w;
             }
-            --n;
-            --max;
-            p++;
-            dst++;
         }
-
-        srcva = va0 + PGSIZE;
-    }
-    if (got_null) {
-        return 0;
-    } else {
-        return -1;
+        for (; n > 0; n--) {
+            if ((*dst++ = *p++) == '\0')
+                return 0;
+        }
     }
+    return -1;
 }
@@ -0,0 +1,449 @@
+//
+// Demand-paged mappings.
+//
+// exec() doesn't read a program into memory: it records each
+// loadable segment as a vma of the process, and the segment's
+// pages are read in one at a time as the program touches them.
+// Pages holding nothing but file data come from the page cache
+// (pcache.c), so every process running a program shares one
+// copy of its text; writable segments map those same pages
+// copy-on-write. The page at the end of the file data, and the
+// zero-filled pages after it (.bss), are private.
+//
+// mmap() makes the same kind of vma, of a file or of zeroes,
+// in the space between the heap and the trap frame. A private
+// mapping works just like a program segment. A shared mapping
+// of a file maps the page cache's pages writable, so that the
+// processes mapping it, and read() and write() of the file, see
+// each other's stores, and munmap()
+// or exit() writes the pages the process dirtied back to the
+// file.
+//
+// A shared memory segment (shm.c) is mapped the same way as a
+// shared file mapping, the segment's pages standing in for the
+// page cache's; there's nothing to write back.
+//
+// Faulting in a page may read the file or swap (swap.c), and
+// so sleep. copyin() and copyout() are sometimes called with a
+// spinlock held (e.g. in piperead()), or with the backing file's
+// inode locked (a program reading its own binary), so the paths
+// that do that fault the user buffer in first with
+// vma_prefault().
+//
+
+#include "types.h"
+#include "param.h"
+#include "memlayout.h"
+#include "riscv.h"
+#include "spinlock.h"
+#include "sleeplock.h"
+#include "proc.h"
+#include "defs.h"
+#include "fs.h"
+#include "file.h"
+#include "mman.h"
+#include "memstat.h"
+
+// The vma of p that covers va, or 0.
+static struct vma*
+vma_find(struct proc* p, uint64_t va)
+{
+    for (struct vma* v = p->vmas; v < &p->vmas[NVMA]; v++) {
+        if (v->flags && va >= v->start && va < v->end)
+            return v;
+    }
+    return 0;
+}
+
+// Read in and map the page at va (page-aligned) of v.
+// Returns 0 on success, -1 if out of memory.
+static int
+vma_fill(struct proc* p, struct vma* v, uint64_t va)
+{
+    uint64_t off = va - v->start;
+    int perm = v->perm | PTE_U;
+    char* mem;
+
+    if (v->shm) {
+        // the segment's page itself.
+        if ((mem = shm_page(v->shm, (v->off + off) / PGSIZE)) == 0)
+            return -1;
+    } else if ((v->flags & MAP_SHARED) && off < v->filesz) {
+        // the page cache's copy itself, stores and all.
+        ilock(v->ip);
+        mem = pcache_get(v->ip, (v->off + off) / PGSIZE, 1);
+        iunlock(v->ip);
+        if (mem == 0)
+            return -1;
+    } else if (off + PGSIZE <= v->filesz) {
+        // all file data: share the page cache's copy.
+        ilock(v->ip);
+        mem = pcache_get(v->ip, (v->off + off) / PGSIZE, 0);
+        iunlock(v->ip);
+        if (mem == 0)
+            return -1;
+        if (perm & PTE_W)
+            perm = (perm & ~PTE_W) | PTE_COW;
+    } else {
+        // the tail of the file data, if any, then zeroes.
+        if ((mem = k_alloc_zeroed()) == 0)
+            return -1;
+        k_use(mem, MU_USER);
+        if (off < v->filesz) {
+            ilock(v->ip);
+            readi(v->ip, 0, (uint64_t)mem, v->off + off, v->filesz - off);
+            iunlock(v->ip);
+        }
+    }
+
+    if (map_pages(p->pagetable, va, PGSIZE, (uint64_t)mem, perm) != 0) {
+        k_free(mem);
+        return -1;
+    }
+    return 0;
+}
+
+// Could the 2 MiB-aligned region around va be a megapage of
+// heap? It has to be below p->sz and clear of program segments.
+static int
+heap_megapage(struct proc* p, uint64_t va)
+{
+    uint64_t a = MEGAPGROUNDDOWN(va);
+
+    if (a + MEGAPGSIZE > p->sz)
+        return 0;
+    for (struct vma* v = p->vmas; v < &p->vmas[NVMA]; v++) {
+        if (v->flags && v->start < a + MEGAPGSIZE && v->end > a)
+            return 0;
+    }
+    return 1;
+}
+
+// Make the user page of p holding va present, and allow access
+// to it, on a page fault or before copyin()/copyout() touch it.
+// Like uvm_fault(), which handles everything that isn't a
+// not-yet-filled page of a vma or a heap megapage.
+// Returns the physical address of the page, or 0.
+uint64_t vma_fault(struct proc* p, uint64_t va, int access)
+{
+    struct vma* v;
+    pte_t* pte;
+
+    if (va >= MAXVA)
+        return 0;
+    va = PGROUNDDOWN(va);
+    v = vma_find(p, va);
+    if (v == 0 && va >= p->sz)
+        return 0;
+    if (v != 0 && (v->perm & FAULT_PERM(access)) == 0)
+        return 0; // e.g. a store to a read-only mapping
+
+    pte = walk(p->pagetable, va, 0);
+    if (pte != 0 && (*pte & PTE_SWAP)) {
+        if (swap_in(pte) != 0)
+            return 0;
+    } else if (pte == 0 || (*pte & PTE_V) == 0) {
+        if (v != 0) {
+            if (vma_fill(p, v, va) != 0)
+                return 0;
+        } else if (heap_megapage(p, va)) {
+            uvm_megapage(p->pagetable, va); // else uvm_fault() maps 4 KiB
+        }
+    }
+    return uvm_fault(p->pagetable, va, p->sz, access);
+}
+
+// Read in the file-backed and swapped-out pages of the user
+// buffer [va, va+len) ahead of a copyin()/copyout() that can't
+// sleep. Heap pages are left to be allocated as the copy
+// touches them.
+void vma_prefault(struct proc* p, uint64_t va, uint64_t len)
+{
+    struct vma* v;
+    pte_t* pte;
+
+    if (va + len < va)
+        len = -va;
+    for (uint64_t a = PGROUNDDOWN(va); a < va + len; a += PGSIZE) {
+        if ((v = vma_find(p, a)) == 0 && a >= p->sz)
+            break;
+        pte = walk(p->pagetable, a, 0);
+        if (pte != 0 && (*pte & PTE_SWAP))
+            swap_in(pte);
+        else if (pte != 0 && (*pte & PTE_V) != 0)
+            continue;
+        else if (v != 0 && a - v->start < v->filesz)
+            vma_fill(p, v, a);
+    }
+}
+
+// Fill in every page of p's shared mmap() regions, ahead of
+// fork(), so that the child gets the very same pages instead of
+// later filling in its own. Returns 0, or -1 if out of memory.
+int vma_populate_shared(struct proc* p)
+{
+    pte_t* pte;
+
+    for (struct vma* v = p->vmas; v < &p->vmas[NVMA]; v++) {
+        if ((v->flags & VMA_MMAP) == 0 || (v->flags & MAP_SHARED) == 0)
+            continue;
+        for (uint64_t a = v->start; a < v->end; a += PGSIZE) {
+            pte = walk(p->pagetable, a, 0);
+            if ((pte == 0 || (*pte & PTE_V) == 0) && vma_fill(p, v, a) != 0)
+                return -1;
+        }
+    }
+    return 0;
+}
+
+// Give the child np a copy of p's mappings, for fork(), and
+// the pages of its mmap() regions: copy-on-write if private,
+// the same pages if shared. The heap and program segments are
+// uvmcopy()'s job. Doesn't sleep, since fork() holds np->lock.
+// Returns 0, or -1 if out of memory, having undone everything.
+int vma_copy(struct proc* np, struct proc* p)
+{
+    struct vma* v;
+    int i;
+
+    for (i = 0; i < NVMA; i++) {
+        v = &p->vmas[i];
+        if ((v->flags & VMA_MMAP)
+            && uvmcopy_range(p->pagetable, np->pagetable, v->start, v->end, (v->flags & MAP_SHARED) != 0) != 0)
+            goto err;
+    }
+    for (i = 0; i < NVMA; i++) {
+        np->vmas[i] = p->vmas[i];
+        if (np->vmas[i].ip)
+            idup(np->vmas[i].ip);
+        if (np->vmas[i].shm)
+            shm_dup(np->vmas[i].shm);
+    }
+    return 0;
+
+err:
+    while (--i >= 0) {
+        v = &p->vmas[i];
+        if (v->flags & VMA_MMAP)
+            uvm_unmap(np->pagetable, v->start, (v->end - v->start) / PGSIZE, UVM_TEARDOWN);
+    }
+    return -1;
+}
+
+// Cut p's mappings off at sz, when sbrk() shrinks it, so that
+// growing it again yields zeroed pages rather than the file.
+void vma_trim(struct proc* p, uint64_t sz)
+{
+    sz = PGROUNDUP(sz);
+    for (struct vma* v = p->vmas; v < &p->vmas[NVMA]; v++) {
+        if (v->flags == 0 || (v->flags & VMA_MMAP) || v->end <= sz)
+            continue;
+        v->end = v->start < sz ? sz : v->start;
+        if (v->filesz > v->end - v->start)
+            v->filesz = v->end - v->start;
+    }
+}
+
+// The lowest mmap() region of p, or HEAPTOP: how far the heap
+// can grow.
+uint64_t vma_floor(struct proc* p)
+{
+    uint64_t floor = HEAPTOP;
+
+    for (struct vma* v = p->vmas; v < &p->vmas[NVMA]; v++) {
+        if ((v->flags & VMA_MMAP) && v->start < floor)
+            floor = v->start;
+    }
+    return floor;
+}
+
+// Does [start, end) overlap any mapping of p?
+static int
+vma_overlap(struct proc* p, uint64_t start, uint64_t end)
+{
+    for (struct vma* v = p->vmas; v < &p->vmas[NVMA]; v++) {
+        if (v->flags && v->start < end && v->end > start)
+            return 1;
+    }
+    return 0;
+}
+
+// Map len bytes for mmap(): of ip or of segment shm from off
+// (page-aligned), or zeroes if both are 0. The region goes in
+// the highest hole below MMAPTOP, or just below the mmap()
+// region above it, that is big enough and clear of the heap.
+// Returns its address, or -1.
+uint64_t vma_mmap(struct proc* p, uint64_t len, int perm, int flags, struct inode* ip, struct shm* shm, uint_t off)
+{
+    struct vma *v, *free = 0;
+    uint64_t va = 0, end;
+
+    len = PGROUNDUP(len);
+    if (len == 0 || len > MMAPTOP)
+        return -1;
+    if (shm && (uint64_t)off + len > shm_size(shm))
+        return -1; // a segment doesn't grow
+
+    for (v = p->vmas; v < &p->vmas[NVMA]; v++) {
+        if (v->flags == 0 && free == 0)
+            free = v;
+    }
+    for (int i = -1; i < NVMA; i++) {
+        if (i < 0)
+            end = MMAPTOP;
+        else if (p->vmas[i].flags & VMA_MMAP)
+            end = p->vmas[i].start;
+        else
+            continue;
+        if (end >= len && end - len > va && end - len >= PGROUNDUP(p->sz) && end - len >= MMAPBASE
+            && !vma_overlap(p, end - len, end))
+            va = end - len;
+    }
+    if (free == 0 || va == 0)
+        return -1;
+
+    free->start = va;
+    free->end = va + len;
+    free->perm = perm;
+    free->flags = flags | VMA_MMAP;
+    free->ip = ip;
+    free->shm = shm;
+    free->off = off;
+    free->filesz = 0;
+    if (shm)
+        shm_dup(shm);
+    if (ip) {
+        idup(ip);
+        ilock(ip);
+        if (off < ip->size)
+            free->filesz = ip->size - off < len ? ip->size - off : len;
+        iunlock(ip);
+    }
+    return va;
+}
+
+// Write the pages of shared file mapping v in [a, b) that the
+// process has stored to back to the file, a transaction per
+// page, without growing the file.
+static void
+vma_writeback(struct proc* p, struct vma* v, uint64_t a, uint64_t b)
+{
+    pte_t* pte;
+    uint_t off;
+
+    for (; a < b; a += PGSIZE) {
+        pte = walk(p->pagetable, a, 0);
+        if (pte == 0 || (*pte & PTE_V) == 0 || (*pte & PTE_D) == 0)
+            continue;
+        off = v->off + (a - v->start);
+        begin_op();
+        ilock(v->ip);
+        if (off < v->ip->size)
+            writei(v->ip, 0, PTE2PA(*pte), off, v->ip->size - off < PGSIZE ? v->ip->size - off : PGSIZE);
+        iunlock(v->ip);
+        end_op();
+        *pte &= ~PTE_D;
+    }
+}
+
+// Unmap the part of v that overlaps [a, b), shrinking v, or
+// splitting it in two, or freeing its slot. do_free is passed
+// on to uvm_unmap(). Returns -1, having unmapped nothing, if v
+// needs splitting and there's no slot for the upper part, or
+// if out of memory.
+static int
+vma_unmap(struct proc* p, struct vma* v, uint64_t a, uint64_t b, int do_free)
+{
+    struct vma* w = 0;
+
+    if (a < v->start)
+        a = v->start;
+    if (b > v->end)
+        b = v->end;
+
+    if (a > v->start && b < v->end) {
+        for (w = p->vmas; w < &p->vmas[NVMA] && w->flags; w++)
+            ;
+        if (w == &p->vmas[NVMA])
+            return -1;
+    }
+
+    if (v->ip && (v->flags & MAP_SHARED))
+        vma_writeback(p, v, a, b);
+    if (uvm_unmap(p->pagetable, a, (b - a) / PGSIZE, do_free) != 0)
+        return -1;
+
+    if (w) {
+        *w = *v;
+        w->start = b;
+        w->off += b - v->start;
+        w->filesz = w->filesz > b - v->start ? w->filesz - (b - v->start) : 0;
+        if (w->ip)
+            idup(w->ip);
+        if (w->shm)
+            shm_dup(w->shm);
+        v->end = b;
+    }
+
+    if (a == v->start && b == v->end) {
+        if (v->ip) {
+            begin_op();
+            iput(v->ip);
+            end_op();
+        }
+        if (v->shm)
+            shm_put(v->shm);
+        memset(v, 0, sizeof(*v));
+    } else if (a == v->start) {
+        v->filesz = v->filesz > b - a ? v->filesz - (b - a) : 0;
+        v->off += b - a;
+        v->start = b;
+    } else {
+        v->end = a;
+        if (v->filesz > a - v->start)
+            v->filesz = a - v->start;
+    }
+    return 0;
+}
+
+// munmap(): unmap the mmap() regions of p in [va, va+len).
+// Returns 0, or -1 if the arguments are bad, or out of slots
+// or memory.
+int vma_munmap(struct proc* p, uint64_t va, uint64_t len)
+{
+    uint64_t end = va + PGROUNDUP(len);
+
+    if (va % PGSIZE != 0 || len == 0 || end < va || end > MMAPTOP)
+        return -1;
+    for (struct vma* v = p->vmas; v < &p->vmas[NVMA]; v++) {
+        if ((v->flags & VMA_MMAP) && v->start < end && v->end > va) {
+            if (vma_unmap(p, v, va, end, 1) != 0)
+                return -1;
+        }
+    }
+    return 0;
+}
+
+// Unmap all of p's mmap() regions, writing back shared file
+// pages, for exit() and exec(), which are done with p's page
+// table. Must not be in a transaction.
+void vma_munmap_all(struct proc* p)
+{
+    for (struct vma* v = p->vmas; v < &p->vmas[NVMA]; v++) {
+        if (v->flags & VMA_MMAP)
+            vma_unmap(p, v, v->start, v->end, UVM_TEARDOWN);
+    }
+}
+
+// Drop the file and segment references of the NVMA mappings
+// in vmas[]. Caller must be inside a transaction, for iput().
+void vma_put(struct vma* vmas)
+{
+    for (struct vma* v = vmas; v < &vmas[NVMA]; v++) {
+        if (v->ip)
+            iput(v->ip);
+        if (v->shm)
+            shm_put(v->shm);
+        memset(v, 0, sizeof(*v));
+    }
+}
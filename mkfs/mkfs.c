@@ -108,7 +108,8 @@ int main(int argc, char* argv[])
 
     freeblock = nmeta; // the first free block that we can allocate
 
-    for (i = 0; i < FSSIZE; i++)
+    // the swap area follows the file system (see kernel/swap.c).
+    for (i = 0; i < FSSIZE + SWAPSIZE; i++)
         wsect(i, zeroes);
 
     memset(buf, 0, sizeof(buf));
@@ -0,0 +1,764 @@
+#include "kernel/param.h"
+#include "kernel/types.h"
+#include "kernel/stat.h"
+#include "user/user.h"
+#include "kernel/riscv.h"
+#include "kernel/fcntl.h"
+#include "kernel/mman.h"
+#include "kernel/pstat.h"
+
+//
+// Micro-benchmarks for kernel hot paths.  bench without arguments
+// runs them all and bench <name> runs <name>.  Times come from the
+// time CSR (rdtime), which ticks at 10 MHz on qemu's virt machine,
+// so 1 tick = 100 ns.  Run qemu with CPUS=n to see how things scale
+// with the number of harts.
+//
+
+#define TIMEBASE 10000000 // time CSR ticks per second
+
+static inline uint64_t
+rdtime(void)
+{
+    uint64_t x;
+    asm volatile("rdtime %0" : "=r"(x));
+    return x;
+}
+
+// fork n children that each run f(arg), wait for all of them,
+// and return the elapsed time in time CSR ticks.
+uint64_t
+forkn(int n, void f(int), int arg)
+{
+    uint64_t t0 = rdtime();
+    for (int i = 0; i < n; i++) {
+        int pid = fork();
+        if (pid < 0) {
+            printf("bench: fork failed\n");
+            exit(1);
+        }
+        if (pid == 0) {
+            f(arg);
+            exit(0);
+        }
+    }
+    for (int i = 0; i < n; i++) {
+        int xstatus;
+        wait(&xstatus);
+        if (xstatus != 0) {
+            printf("bench: child failed\n");
+            exit(1);
+        }
+    }
+    return rdtime() - t0;
+}
+
+//
+// physical page allocator throughput.
+// each child grows and shrinks its heap, so every iteration is
+// NPG k_alloc()s and NPG k_free()s. with per-hart freelists the
+// aggregate pages/ms should grow with the number of harts.
+//
+
+#define KALLOC_NPG 64
+#define KALLOC_ITERS 200
+
+void kallocchild(int iters)
+{
+    for (int i = 0; i < iters; i++) {
+        char* a = sbrk(KALLOC_NPG * PGSIZE);
+        if (a == (char*)-1) {
+            printf("kalloc: sbrk failed\n");
+            exit(1);
+        }
+        for (int j = 0; j < KALLOC_NPG; j++)
+            a[j * PGSIZE] = 1;
+        sbrk(-(KALLOC_NPG * PGSIZE));
+    }
+}
+
+void kallocbench(char* s)
+{
+    for (int n = 1; n <= NCPU; n *= 2) {
+        uint64_t dt = forkn(n, kallocchild, KALLOC_ITERS);
+        uint64_t pages = (uint64_t)n * KALLOC_ITERS * KALLOC_NPG;
+        printf("%s: %d procs %ld pages %ld ms %ld pages/ms\n", s, n, pages,
+            dt / (TIMEBASE / 1000), pages * (TIMEBASE / 1000) / (dt ? dt : 1));
+    }
+}
+
+//
+// fork+exec latency, the way sh runs a command: the child
+// immediately exec()s, so eagerly copying the parent's memory
+// in fork() is wasted work. the parent carries a FORKEXEC_HEAP
+// heap to make that cost visible. compare against a kernel
+// without copy-on-write fork to see the difference, and with
+// spawn(), which copies nothing, not even the page table.
+//
+
+#define FORKEXEC_HEAP (4 * 1024 * 1024)
+#define FORKEXEC_ITERS 50
+
+void forkexecbench(char* s)
+{
+    char* a = sbrk(FORKEXEC_HEAP);
+    if (a == (char*)-1) {
+        printf("%s: sbrk failed\n", s);
+        exit(1);
+    }
+    for (int i = 0; i < FORKEXEC_HEAP; i += PGSIZE)
+        a[i] = 1;
+
+    // fork alone, child exits at once.
+    uint64_t t0 = rdtime();
+    for (int i = 0; i < FORKEXEC_ITERS; i++) {
+        int pid = fork();
+        if (pid < 0) {
+            printf("%s: fork failed\n", s);
+            exit(1);
+        }
+        if (pid == 0)
+            exit(0);
+        wait(0);
+    }
+    uint64_t dt = rdtime() - t0;
+    printf("%s: fork+exit %ld us/iter\n", s, dt / FORKEXEC_ITERS / (TIMEBASE / 1000000));
+
+    // fork, then exec a small program.
+    t0 = rdtime();
+    for (int i = 0; i < FORKEXEC_ITERS; i++) {
+        int pid = fork();
+        if (pid < 0) {
+            printf("%s: fork failed\n", s);
+            exit(1);
+        }
+        if (pid == 0) {
+            char* argv[] = { "echo", 0 };
+            close(1); // keep the output quiet
+            exec("echo", argv);
+            exit(1);
+        }
+        wait(0);
+    }
+    dt = rdtime() - t0;
+    printf("%s: fork+exec %ld us/iter\n", s, dt / FORKEXEC_ITERS / (TIMEBASE / 1000000));
+
+    // spawn the same program, without copying the heap.
+    int fds[3] = { 0, -1, 2 };
+    t0 = rdtime();
+    for (int i = 0; i < FORKEXEC_ITERS; i++) {
+        char* argv[] = { "echo", 0 };
+        if (spawn("echo", argv, fds) < 0) {
+            printf("%s: spawn failed\n", s);
+            exit(1);
+        }
+        wait(0);
+    }
+    dt = rdtime() - t0;
+    printf("%s: spawn %ld us/iter\n", s, dt / FORKEXEC_ITERS / (TIMEBASE / 1000000));
+
+    sbrk(-FORKEXEC_HEAP);
+}
+
+//
+// shell pipeline startup: the time to run "echo hi | grep x",
+// started the way sh used to (fork a copy of the shell for the
+// pipeline, which forks one per command, each exec()ing) and
+// the way it does now (spawn() each command from the shell).
+//
+
+#define PIPELINE_ITERS 30
+
+void pipelinebench(char* s)
+{
+    char* echoargv[] = { "echo", "hi", 0 };
+    char* grepargv[] = { "grep", "x", 0 };
+    int p[2], fds[3];
+
+    uint64_t t0 = rdtime();
+    for (int i = 0; i < PIPELINE_ITERS; i++) {
+        if (fork() == 0) {
+            pipe(p);
+            if (fork() == 0) {
+                close(1);
+                dup(p[1]);
+                close(p[0]);
+                close(p[1]);
+                exec("echo", echoargv);
+                exit(1);
+            }
+            if (fork() == 0) {
+                close(0);
+                dup(p[0]);
+                close(p[0]);
+                close(p[1]);
+                exec("grep", grepargv);
+                exit(1);
+            }
+            close(p[0]);
+            close(p[1]);
+            wait(0);
+            wait(0);
+            exit(0);
+        }
+        wait(0);
+    }
+    uint64_t dt = rdtime() - t0;
+    printf("%s: fork+exec %ld us/pipeline\n", s, dt / PIPELINE_ITERS / (TIMEBASE / 1000000));
+
+    t0 = rdtime();
+    for (int i = 0; i < PIPELINE_ITERS; i++) {
+        if (pipe(p) < 0) {
+            printf("%s: pipe failed\n", s);
+            exit(1);
+        }
+        fds[0] = 0;
+        fds[1] = p[1];
+        fds[2] = 2;
+        int n = spawn("echo", echoargv, fds) >= 0;
+        fds[0] = p[0];
+        fds[1] = 1;
+        n += spawn("grep", grepargv, fds) >= 0;
+        close(p[0]);
+        close(p[1]);
+        if (n != 2) {
+            printf("%s: spawn failed\n", s);
+            exit(1);
+        }
+        wait(0);
+        wait(0);
+    }
+    dt = rdtime() - t0;
+    printf("%s: spawn %ld us/pipeline\n", s, dt / PIPELINE_ITERS / (TIMEBASE / 1000000));
+}
+
+//
+// a big heap, touched a page at a time in a scattered order so
+// that every load needs a fresh translation. the heap's aligned
+// 2 MiB stretches are mapped with megapages, which take one TLB
+// entry and no level-0 page-table page each. compare against a
+// kernel without user megapages to see the difference.
+//
+
+#define MEGA_HEAP (32 * 1024 * 1024)
+#define MEGA_ROUNDS 16
+
+void megabench(char* s)
+{
+    int npg = MEGA_HEAP / PGSIZE;
+    char* a = sbrk(MEGA_HEAP);
+    if (a == (char*)-1) {
+        printf("%s: sbrk failed\n", s);
+        exit(1);
+    }
+
+    uint64_t t0 = rdtime();
+    for (int i = 0; i < npg; i++)
+        a[i * PGSIZE] = 1;
+    uint64_t dt = rdtime() - t0;
+    printf("%s: first touch %ld us/MiB\n", s, dt / (MEGA_HEAP >> 20) / (TIMEBASE / 1000000));
+
+    // 997 is prime, so i * 997 % npg visits every page once
+    // per round, hopping all over the heap.
+    volatile char* v = a;
+    t0 = rdtime();
+    for (int r = 0; r < MEGA_ROUNDS; r++) {
+        for (int i = 0; i < npg; i++)
+            (void)v[(uint64_t)i * 997 % npg * PGSIZE + (i % 64) * 64];
+    }
+    dt = rdtime() - t0;
+    printf("%s: scattered loads %ld ns/load\n", s,
+        dt * (1000000000 / TIMEBASE) / ((uint64_t)MEGA_ROUNDS * npg));
+
+    sbrk(-MEGA_HEAP);
+}
+
+//
+// scanning a file with read() versus through mmap(). read()
+// copies every byte out to the user buffer; a private mapping
+// hands the process the page cache's pages, so each round
+// costs a page fault per page and no copying.
+//
+
+#define SCAN_SIZE (256 * 1024) // close to the largest file
+#define SCAN_ROUNDS 20
+
+static uint64_t
+scansum(char* p, int n)
+{
+    uint64_t sum = 0;
+    for (int i = 0; i < n; i += sizeof(uint64_t))
+        sum += *(uint64_t*)(p + i);
+    return sum;
+}
+
+void mmapbench(char* s)
+{
+    static char buf[PGSIZE];
+    uint64_t sum1 = 0, sum2 = 0;
+    int fd, n;
+
+    unlink("bench.scan");
+    fd = open("bench.scan", O_CREATE | O_RDWR);
+    if (fd < 0) {
+        printf("%s: create failed\n", s);
+        exit(1);
+    }
+    for (int i = 0; i < SCAN_SIZE; i += PGSIZE) {
+        memset(buf, i / PGSIZE, PGSIZE);
+        if (write(fd, buf, PGSIZE) != PGSIZE) {
+            printf("%s: write failed\n", s);
+            exit(1);
+        }
+    }
+
+    uint64_t t0 = rdtime();
+    for (int r = 0; r < SCAN_ROUNDS; r++) {
+        close(fd);
+        fd = open("bench.scan", O_RDONLY);
+        while ((n = read(fd, buf, PGSIZE)) > 0)
+            sum1 += scansum(buf, n);
+    }
+    uint64_t dt = rdtime() - t0;
+    printf("%s: read() scan %ld us/MiB\n", s,
+        dt * 1024 * 1024 / ((uint64_t)SCAN_ROUNDS * SCAN_SIZE) / (TIMEBASE / 1000000));
+
+    t0 = rdtime();
+    for (int r = 0; r < SCAN_ROUNDS; r++) {
+        char* a = mmap(0, SCAN_SIZE, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (a == MAP_FAILED) {
+            printf("%s: mmap failed\n", s);
+            exit(1);
+        }
+        sum2 += scansum(a, SCAN_SIZE);
+        munmap(a, SCAN_SIZE);
+    }
+    dt = rdtime() - t0;
+    printf("%s: mmap() scan %ld us/MiB\n", s,
+        dt * 1024 * 1024 / ((uint64_t)SCAN_ROUNDS * SCAN_SIZE) / (TIMEBASE / 1000000));
+
+    if (sum1 != sum2)
+        printf("%s: scans disagree\n", s);
+    close(fd);
+    unlink("bench.scan");
+}
+
+//
+// pipe ping-pong: two processes bounce a byte back and forth,
+// so every round trip is four system calls and two context
+// switches, each a trip through the trampoline. with ASIDs
+// those leave the TLB alone; compare against a kernel built
+// with NOASID=1, which flushes it every time.
+//
+
+#define PINGPONG_ITERS 10000
+
+void pingpongbench(char* s)
+{
+    int ping[2], pong[2];
+    char c = 0;
+
+    if (pipe(ping) < 0 || pipe(pong) < 0) {
+        printf("%s: pipe failed\n", s);
+        exit(1);
+    }
+    int pid = fork();
+    if (pid < 0) {
+        printf("%s: fork failed\n", s);
+        exit(1);
+    }
+    if (pid == 0) {
+        for (int i = 0; i < PINGPONG_ITERS; i++) {
+            if (read(ping[0], &c, 1) != 1 || write(pong[1], &c, 1) != 1)
+                exit(1);
+        }
+        exit(0);
+    }
+
+    uint64_t t0 = rdtime();
+    for (int i = 0; i < PINGPONG_ITERS; i++) {
+        if (write(ping[1], &c, 1) != 1 || read(pong[0], &c, 1) != 1) {
+            printf("%s: pipe i/o failed\n", s);
+            exit(1);
+        }
+    }
+    uint64_t dt = rdtime() - t0;
+    wait(0);
+    printf("%s: %ld ns/round trip\n", s, dt * (1000000000 / TIMEBASE) / PINGPONG_ITERS);
+
+    close(ping[0]);
+    close(ping[1]);
+    close(pong[0]);
+    close(pong[1]);
+}
+
+//
+// scheduling throughput: 1 to 16 pairs of processes ping-pong
+// over pipes at once, so each hart does nothing but block,
+// wake the partner and switch. run with CPUS=1..8: with
+// per-hart run queues switches/ms should scale with the harts,
+// where a scan of the whole process table would not.
+//
+
+#define SCHED_ITERS 2000
+
+void schedpair(int iters)
+{
+    int ping[2], pong[2];
+    char c = 0;
+
+    if (pipe(ping) < 0 || pipe(pong) < 0)
+        exit(1);
+    int pid = fork();
+    if (pid < 0)
+        exit(1);
+    if (pid == 0) {
+        for (int i = 0; i < iters; i++) {
+            if (read(ping[0], &c, 1) != 1 || write(pong[1], &c, 1) != 1)
+                exit(1);
+        }
+        exit(0);
+    }
+    for (int i = 0; i < iters; i++) {
+        if (write(ping[1], &c, 1) != 1 || read(pong[0], &c, 1) != 1)
+            exit(1);
+    }
+    int xstatus;
+    wait(&xstatus);
+    exit(xstatus);
+}
+
+void schedbench(char* s)
+{
+    for (int pairs = 1; pairs <= 16; pairs *= 2) {
+        uint64_t dt = forkn(pairs, schedpair, SCHED_ITERS);
+        uint64_t nswitch = (uint64_t)pairs * SCHED_ITERS * 2;
+        printf("%s: %d pairs %ld switches/ms\n", s, pairs,
+            nswitch * (TIMEBASE / 1000) / (dt ? dt : 1));
+    }
+}
+
+//
+// keystroke latency under load: a stand-in for sh blocks reading
+// a pipe and echoes each byte back, while CPU-bound processes
+// spin on every hart. each "keystroke" is timed from the write
+// to the echo's arrival, one per tick as a typist would. the
+// hogs sink to the lowest feedback level and the echoer, which
+// blocks on a pipe, stays at the top, so it should be answered
+// at once rather than after a hog's time slice; renicing the
+// hogs to NICE_MAX should make no difference for it.
+//
+
+#define KEY_HOGS 8 // one per hart, at most
+#define KEY_PRESSES 20
+
+void keystrokes(char* s, int nhogs, int nice)
+{
+    int hogs[KEY_HOGS], in[2], out[2];
+    char c = 'x';
+
+    for (int i = 0; i < nhogs; i++) {
+        if ((hogs[i] = fork()) == 0) {
+            setpriority(0, nice);
+            for (volatile int spin = 0;; spin++)
+                ;
+        }
+    }
+    if (pipe(in) < 0 || pipe(out) < 0) {
+        printf("%s: pipe failed\n", s);
+        exit(1);
+    }
+    int echo = fork();
+    if (echo == 0) {
+        while (read(in[0], &c, 1) == 1)
+            write(out[1], &c, 1);
+        exit(0);
+    }
+    close(in[0]);
+    close(out[1]);
+
+    sleep(2); // let the hogs use up their first slices
+    uint64_t total = 0, worst = 0;
+    for (int i = 0; i < KEY_PRESSES; i++) {
+        sleep(1);
+        uint64_t t0 = rdtime();
+        if (write(in[1], &c, 1) != 1 || read(out[0], &c, 1) != 1) {
+            printf("%s: pipe i/o failed\n", s);
+            exit(1);
+        }
+        uint64_t dt = rdtime() - t0;
+        total += dt;
+        if (dt > worst)
+            worst = dt;
+    }
+    close(in[1]);
+    close(out[0]);
+    for (int i = 0; i < nhogs; i++)
+        kill(hogs[i]);
+    for (int i = 0; i < nhogs + 1; i++)
+        wait(0);
+    printf("%s: %d hogs at nice %d: %ld us/key, worst %ld us\n", s, nhogs, nice,
+        total / KEY_PRESSES / (TIMEBASE / 1000000), worst / (TIMEBASE / 1000000));
+}
+
+void keybench(char* s)
+{
+    keystrokes(s, 0, 0);
+    keystrokes(s, KEY_HOGS, 0);
+    keystrokes(s, KEY_HOGS, NICE_MAX);
+}
+
+//
+// CPU shares: CPU-bound processes, half at nice 0 and half at
+// another nice value, spin for a while, and pstat() says how
+// much CPU time each half got. under sched=fair the shares
+// should follow the weights (nice 5 gets about a third of what
+// nice 0 does, nice 10 about a tenth), under sched=rr they
+// should be even, and under mlfq nice moves a process to a
+// worse queue, which with no one else there may do little.
+// use enough hogs to keep every hart busy with both kinds.
+//
+
+#define SHARE_HOGS 8 // half at each nice value; two per hart, at most
+#define SHARE_TICKS 50
+
+void shares(char* s, int nice)
+{
+    static struct pstat ps[NPROC];
+    int hogs[SHARE_HOGS];
+    uint64_t t[2] = { 0, 0 };
+    int n;
+
+    for (int i = 0; i < SHARE_HOGS; i++) {
+        if ((hogs[i] = fork()) == 0) {
+            setpriority(0, i % 2 ? nice : 0);
+            for (volatile int spin = 0;; spin++)
+                ;
+        }
+    }
+    sleep(SHARE_TICKS);
+    if ((n = pstat(ps, NPROC)) < 0) {
+        printf("%s: pstat failed\n", s);
+        exit(1);
+    }
+    for (int i = 0; i < SHARE_HOGS; i++)
+        kill(hogs[i]);
+    for (int i = 0; i < SHARE_HOGS; i++)
+        wait(0);
+
+    for (int j = 0; j < n; j++) {
+        for (int i = 0; i < SHARE_HOGS; i++)
+            if (ps[j].pid == hogs[i])
+                t[i % 2] += ps[j].runtime;
+    }
+    uint64_t total = t[0] + t[1];
+    printf("%s: nice 0 vs nice %d: %ld%% vs %ld%% of %ld ms\n", s, nice,
+        t[0] * 100 / (total ? total : 1), t[1] * 100 / (total ? total : 1), total / 1000);
+}
+
+void sharebench(char* s)
+{
+    shares(s, 0);
+    shares(s, 5);
+    shares(s, 10);
+}
+
+//
+// system call latency: a loop of getpid(), which does nothing
+// but the trip into the kernel and back. compare a kernel built
+// with SHAREKVM=1, whose traps don't switch page tables, and one
+// built with NOASID=1, whose traps flush the TLB.
+//
+
+#define SYSCALL_ITERS 100000
+
+void syscallbench(char* s)
+{
+    uint64_t t0 = rdtime();
+    for (int i = 0; i < SYSCALL_ITERS; i++)
+        getpid();
+    uint64_t dt = rdtime() - t0;
+    printf("%s: getpid %ld ns/call\n", s, dt * (1000000000 / TIMEBASE) / SYSCALL_ITERS);
+}
+
+//
+// moving bulk data from a producer to a consumer: through a
+// pipe, which copies every byte in and out of the kernel, and
+// through a shared memory segment, with the pipe carrying only
+// a byte per buffer to say whose turn it is.
+//
+
+#define BULK_TOTAL (4 * 1024 * 1024)
+#define BULK_BUF (64 * 1024)
+
+static void
+bulkfill(char* p, int n, int seq)
+{
+    for (int i = 0; i < n; i += sizeof(uint64_t))
+        *(uint64_t*)(p + i) = seq + i;
+}
+
+void bulkbench(char* s)
+{
+    static char buf[BULK_BUF];
+    int fds[2], ack[2], n, shm;
+    uint64_t sum = 0;
+    char c;
+
+    // through the pipe.
+    if (pipe(fds) < 0) {
+        printf("%s: pipe failed\n", s);
+        exit(1);
+    }
+    uint64_t t0 = rdtime();
+    if (fork() == 0) {
+        close(fds[0]);
+        for (int off = 0; off < BULK_TOTAL; off += BULK_BUF) {
+            bulkfill(buf, BULK_BUF, off);
+            if (write(fds[1], buf, BULK_BUF) != BULK_BUF)
+                exit(1);
+        }
+        exit(0);
+    }
+    close(fds[1]);
+    while ((n = read(fds[0], buf, sizeof(buf))) > 0)
+        sum += scansum(buf, n);
+    close(fds[0]);
+    wait(0);
+    uint64_t dt = rdtime() - t0;
+    printf("%s: pipe %ld MiB/s\n", s, (uint64_t)BULK_TOTAL * TIMEBASE / (dt ? dt : 1) >> 20);
+
+    // through a segment, a buffer at a time.
+    if ((shm = shmget(0, BULK_BUF)) < 0 || pipe(fds) < 0 || pipe(ack) < 0) {
+        printf("%s: shmget failed\n", s);
+        exit(1);
+    }
+    char* a = mmap(0, BULK_BUF, PROT_READ | PROT_WRITE, MAP_SHARED, shm, 0);
+    if (a == MAP_FAILED) {
+        printf("%s: mmap failed\n", s);
+        exit(1);
+    }
+    t0 = rdtime();
+    if (fork() == 0) {
+        for (int off = 0; off < BULK_TOTAL; off += BULK_BUF) {
+            bulkfill(a, BULK_BUF, off);
+            if (write(fds[1], &c, 1) != 1 || read(ack[0], &c, 1) != 1)
+                exit(1);
+        }
+        exit(0);
+    }
+    uint64_t sum2 = 0;
+    for (int off = 0; off < BULK_TOTAL; off += BULK_BUF) {
+        if (read(fds[0], &c, 1) != 1) {
+            printf("%s: pipe i/o failed\n", s);
+            exit(1);
+        }
+        sum2 += scansum(a, BULK_BUF);
+        write(ack[1], &c, 1);
+    }
+    wait(0);
+    dt = rdtime() - t0;
+    printf("%s: shm %ld MiB/s\n", s, (uint64_t)BULK_TOTAL * TIMEBASE / (dt ? dt : 1) >> 20);
+
+    if (sum != sum2)
+        printf("%s: transfers disagree\n", s);
+    munmap(a, BULK_BUF);
+    close(shm);
+    close(fds[0]);
+    close(fds[1]);
+    close(ack[0]);
+    close(ack[1]);
+}
+
+//
+// read() throughput from the page cache into a big user buffer,
+// which is mostly copyout(): word-aligned to the kernel's page,
+// which copies a word at a time, and one byte off, which can't.
+// the buffer sits in a heap megapage when sbrk() can give one.
+//
+
+#define COPY_BUF (64 * 1024)
+#define COPY_ROUNDS 20
+
+static uint64_t
+readrounds(char* buf)
+{
+    uint64_t t0 = rdtime();
+    for (int r = 0; r < COPY_ROUNDS; r++) {
+        int fd = open("bench.copy", O_RDONLY);
+        if (read(fd, buf, COPY_BUF) != COPY_BUF) {
+            printf("copy: read failed\n");
+            exit(1);
+        }
+        close(fd);
+    }
+    return rdtime() - t0;
+}
+
+void copybench(char* s)
+{
+    static char buf[COPY_BUF];
+    int fd;
+
+    unlink("bench.copy");
+    fd = open("bench.copy", O_CREATE | O_RDWR);
+    if (fd < 0 || write(fd, buf, COPY_BUF) != COPY_BUF) {
+        printf("%s: create failed\n", s);
+        exit(1);
+    }
+    close(fd);
+
+    char* a = sbrk(4 * 1024 * 1024);
+    if (a == (char*)-1) {
+        printf("%s: sbrk failed\n", s);
+        exit(1);
+    }
+    char* big = (char*)(((uint64_t)a + (2 * 1024 * 1024 - 1)) & ~(2 * 1024 * 1024 - 1));
+
+    readrounds(big); // warm up the page cache and the heap
+    uint64_t dt = readrounds(big);
+    printf("%s: read() aligned %ld MiB/s\n", s, (uint64_t)COPY_ROUNDS * COPY_BUF * TIMEBASE / (dt ? dt : 1) >> 20);
+    dt = readrounds(big + 1);
+    printf("%s: read() unaligned %ld MiB/s\n", s, (uint64_t)COPY_ROUNDS * COPY_BUF * TIMEBASE / (dt ? dt : 1) >> 20);
+
+    sbrk(-(4 * 1024 * 1024));
+    unlink("bench.copy");
+}
+
+struct bench {
+    void (*f)(char*);
+    char* s;
+} benches[] = {
+    { kallocbench, "kalloc" },
+    { forkexecbench, "forkexec" },
+    { pipelinebench, "pipeline" },
+    { megabench, "mega" },
+    { mmapbench, "mmap" },
+    { pingpongbench, "pingpong" },
+    { schedbench, "sched" },
+    { keybench, "key" },
+    { sharebench, "share" },
+    { syscallbench, "syscall" },
+    { bulkbench, "bulk" },
+    { copybench, "copy" },
+
+    { 0, 0 },
+};
+
+int main(int argc, char* argv[])
+{
+    char* justone = 0;
+
+    if (argc == 2 && argv[1][0] != '-') {
+        justone = argv[1];
+    } else if (argc > 1) {
+        printf("Usage: bench [name]\n");
+        exit(1);
+    }
+
+    for (struct bench* b = benches; b->s != 0; b++) {
+        if (justone == 0 || strcmp(b->s, justone) == 0)
+            b->f(b->s);
+    }
+    exit(0);
+}
@@ -0,0 +1,53 @@
+#include "kernel/param.h"
+#include "kernel/types.h"
+#include "kernel/memstat.h"
+#include "kernel/riscv.h"
+#include "user/user.h"
+
+// print free physical memory, what the allocated memory is
+// used for, and the buddy allocator's free blocks per order,
+// like /proc/buddyinfo.
+
+static char* uses[NMU] = {
+    [MU_KERNEL] "kernel",
+    [MU_USER] "user",
+    [MU_PGTBL] "page tables",
+    [MU_KSTACK] "kernel stacks",
+    [MU_PIPE] "pipes",
+    [MU_PCACHE] "page cache",
+};
+
+int main(int argc, char* argv[])
+{
+    struct memstat st;
+
+    if (memstat(&st) < 0) {
+        fprintf(2, "free: memstat failed\n");
+        exit(1);
+    }
+
+    printf("total %ld KiB free %ld KiB (cached %ld KiB, zeroed %ld KiB)\n",
+        st.npages * PGSIZE / 1024, st.nfree * PGSIZE / 1024,
+        st.ncached * PGSIZE / 1024, st.nzeroed * PGSIZE / 1024);
+    printf("page cache %ld KiB\n", st.npcache * PGSIZE / 1024);
+    uint64_t used = 0;
+    for (int u = 0; u < NMU; u++)
+        used += st.nuse[u];
+    printf("used %ld KiB:", used * PGSIZE / 1024);
+    for (int u = 0; u < NMU; u++)
+        printf(" %s %ld", uses[u], st.nuse[u] * PGSIZE / 1024);
+    printf("\n");
+    printf("buffer cache %ld KiB (static)\n", st.nbcache * PGSIZE / 1024);
+    printf("swap %ld KiB used %ld KiB (in %ld pages, out %ld pages)\n",
+        st.nswap * PGSIZE / 1024, st.nswapused * PGSIZE / 1024, st.nswapin, st.nswapout);
+
+    // fragmentation: how much of the free memory could
+    // back a block of at least each order.
+    uint64_t above = st.nfree - st.ncached - st.nzeroed;
+    printf("order  blocks  free%%>=order\n");
+    for (int k = 0; k <= MAXORDER; k++) {
+        printf("%d\t%ld\t%ld\n", k, st.nblocks[k], st.nfree ? above * 100 / st.nfree : 0);
+        above -= st.nblocks[k] << k;
+    }
+    exit(0);
+}
@@ -0,0 +1,31 @@
+#include "kernel/param.h"
+#include "kernel/types.h"
+#include "kernel/pstat.h"
+#include "kernel/riscv.h"
+#include "user/user.h"
+
+// list the processes, with their run queue and nice value
+// (see setpriority()), the CPU time they have used and spent
+// waiting for it in milliseconds, and their memory: heap size, resident
+// user memory (pages shared with other processes are counted
+// in each), swapped-out memory and page tables, all in KiB.
+
+int main(int argc, char* argv[])
+{
+    static struct pstat ps[NPROC];
+    int n;
+
+    if ((n = pstat(ps, NPROC)) < 0) {
+        fprintf(2, "ps: pstat failed\n");
+        exit(1);
+    }
+
+    printf("PID\tSTATE\tPRI\tNI\tTIME\tWAIT\tSZ\tRSS\tSWAP\tPT\tNAME\n");
+    for (int i = 0; i < n; i++) {
+        printf("%d\t%s\t%d\t%d\t%ld\t%ld\t%ld\t%ld\t%ld\t%ld\t%s\n", ps[i].pid, ps[i].state,
+            ps[i].prio, ps[i].nice, ps[i].runtime / 1000, ps[i].waittime / 1000,
+            ps[i].sz / 1024, ps[i].rss * PGSIZE / 1024,
+            ps[i].nswap * PGSIZE / 1024, ps[i].npt * PGSIZE / 1024, ps[i].name);
+    }
+    exit(0);
+}
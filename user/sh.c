@@ -55,9 +55,13 @@ struct back_cmd {
 
 int fork1(void); // Fork but panics on failure.
 void panic(char*);
+void syntax(char*);
 struct cmd* parse_cmd(char*);
+void free_cmd(struct cmd*);
 void run_cmd(struct cmd*) __attribute__((noreturn));
 
+int syntax_error; // set by syntax(), for parse_cmd()
+
 // Execute cmd.  Never returns.
 void run_cmd(struct cmd* cmd)
 {
@@ -133,6 +137,130 @@ void run_cmd(struct cmd* cmd)
     exit(0);
 }
 
+// Can cmd run as a stage of a pipeline, or under a redirection,
+// with spawn()? Commands, and pipes and redirections of them,
+// can; not a list, since the shell waits for its left side
+// before it starts its right, and so couldn't start the stages
+// after it: (cat README; echo) | wc would fill the pipe and
+// hang. Nor a background job, which needs a fork.
+static int
+spawnable_stage(struct cmd* cmd)
+{
+    switch (cmd->type) {
+    case EXEC:
+        return 1;
+    case REDIR:
+        struct redir_cmd* rcmd = (struct redir_cmd*)cmd;
+        return rcmd->fd < 3 && spawnable_stage(rcmd->cmd);
+    case PIPE:
+        struct pipe_cmd* pcmd = (struct pipe_cmd*)cmd;
+        return spawnable_stage(pcmd->left) && spawnable_stage(pcmd->right);
+    }
+    return 0;
+}
+
+// Can cmd run with spawn(), straight from the shell, rather
+// than in a forked copy of it? Lists can, at the top level,
+// if each of their commands can.
+int spawnable(struct cmd* cmd)
+{
+    if (cmd->type == LIST) {
+        struct list_cmd* lcmd = (struct list_cmd*)cmd;
+        return spawnable(lcmd->left) && spawnable(lcmd->right);
+    }
+    return spawnable_stage(cmd);
+}
+
+#define MAXPIDS 32
+
+// Wait for the n children in pids[] to exit. Any others that
+// exit meanwhile, background jobs, are reaped in passing.
+static void
+wait_pids(int* pids, int n)
+{
+    while (n > 0) {
+        int pid = wait(0);
+        if (pid < 0)
+            return;
+        for (int i = 0; i < n; i++) {
+            if (pids[i] == pid) {
+                pids[i] = pids[--n];
+                break;
+            }
+        }
+    }
+}
+
+// Start the commands of cmd, which must be spawnable(), with
+// descriptors 0-2 being the shell's fds[0-2]. The pids of the
+// children started are added to pids[], which has n already;
+// returns the new n, for the caller to wait_pids() for. This
+// does what run_cmd() does, without copying the shell for each
+// command only to replace the copy with exec().
+int spawn_cmd(struct cmd* cmd, int* fds, int* pids, int n)
+{
+    int pid, nfds[3];
+
+    switch (cmd->type) {
+    default:
+        panic("spawn_cmd");
+
+    case EXEC:
+        struct exec_cmd* ecmd = (struct exec_cmd*)cmd;
+        if (ecmd->argv[0] == 0) {
+            return n;
+        }
+        if (n == MAXPIDS) {
+            fprintf(2, "too many commands\n");
+            return n;
+        }
+        if ((pid = spawn(ecmd->argv[0], ecmd->argv, fds)) < 0) {
+            fprintf(2, "exec %s failed\n", ecmd->argv[0]);
+            return n;
+        }
+        pids[n] = pid;
+        return n + 1;
+
+    case REDIR:
+        struct redir_cmd* rcmd = (struct redir_cmd*)cmd;
+        int fd = open(rcmd->file, rcmd->mode);
+        if (fd < 0) {
+            fprintf(2, "open %s failed\n", rcmd->file);
+            return n;
+        }
+        memmove(nfds, fds, sizeof(nfds));
+        nfds[rcmd->fd] = fd;
+        n = spawn_cmd(rcmd->cmd, nfds, pids, n);
+        close(fd);
+        return n;
+
+    case PIPE:
+        struct pipe_cmd* pcmd = (struct pipe_cmd*)cmd;
+        int p[2];
+        if (pipe(p) < 0) {
+            fprintf(2, "pipe failed\n");
+            return n;
+        }
+        memmove(nfds, fds, sizeof(nfds));
+        nfds[1] = p[1];
+        n = spawn_cmd(pcmd->left, nfds, pids, n);
+        memmove(nfds, fds, sizeof(nfds));
+        nfds[0] = p[0];
+        n = spawn_cmd(pcmd->right, nfds, pids, n);
+        close(p[0]);
+        close(p[1]);
+        return n;
+
+    case LIST:
+        // only at the top level (see spawnable_stage()), so
+        // nothing else started is waiting on the left side.
+        struct list_cmd* lcmd = (struct list_cmd*)cmd;
+        int n1 = spawn_cmd(lcmd->left, fds, pids, n);
+        wait_pids(pids + n, n1 - n);
+        return spawn_cmd(lcmd->right, fds, pids, n);
+    }
+}
+
 int get_cmd(char* buf, int nbuf)
 {
     write(2, "$ ", 2);
@@ -148,6 +276,8 @@ int get_cmd(char* buf, int nbuf)
 int main(void)
 {
     static char buf[100];
+    static int fds[3] = { 0, 1, 2 };
+    struct cmd* cmd;
     int fd;
 
     // Ensure that three file descriptors are open.
@@ -167,11 +297,20 @@ int main(void)
                 fprintf(2, "cannot cd %s\n", buf + 3);
             continue;
         }
-        // 子进程
-        if (fork1() == 0) {
-            run_cmd(parse_cmd(buf));
+        if ((cmd = parse_cmd(buf)) == 0) {
+            continue;
         }
-        wait(0);
+        if (spawnable(cmd)) {
+            int pids[MAXPIDS];
+            wait_pids(pids, spawn_cmd(cmd, fds, pids, 0));
+        } else {
+            // 子进程
+            if (fork1() == 0) {
+                run_cmd(cmd);
+            }
+            wait(0);
+        }
+        free_cmd(cmd);
     }
     exit(0);
 }
@@ -182,6 +321,17 @@ void panic(char* s)
     exit(1);
 }
 
+// Report a syntax error, once per command line. The parser
+// runs in the shell itself, so it mustn't exit; it gives up
+// on the rest of the line instead.
+void syntax(char* s)
+{
+    if (!syntax_error) {
+        fprintf(2, "%s\n", s);
+    }
+    syntax_error = 1;
+}
+
 int fork1(void)
 {
     int pid;
@@ -340,14 +490,20 @@ struct cmd* nul_terminate(struct cmd*);
 
 // 这个解析, 可以搞成一个 bnf 语法
 
+// Returns 0 after a syntax error.
 struct cmd* parse_cmd(char* s)
 {
     char* es = s + strlen(s); // end of s
+    syntax_error = 0;
     struct cmd* cmd = parse_line(&s, es);
     peek(&s, es, "");
-    if (s != es) { // 没有解析完 cmd -> fatal
+    if (s != es && !syntax_error) { // 没有解析完 cmd
         fprintf(2, "leftovers: %s\n", s); // stderr
-        panic("syntax");
+        syntax("syntax");
+    }
+    if (syntax_error) {
+        free_cmd(cmd);
+        return 0;
     }
     nul_terminate(cmd);
     return cmd;
@@ -356,11 +512,11 @@ struct cmd* parse_cmd(char* s)
 struct cmd* parse_line(char** ps, char* es)
 {
     struct cmd* cmd = parse_pipe(ps, es); // 解析一行的时候, 要先看一下有没有 pipe
-    while (peek(ps, es, "&")) {
+    while (!syntax_error && peek(ps, es, "&")) {
         get_token(ps, es, 0, 0);
         cmd = build_back_cmd(cmd); // <back> & <front>
     }
-    if (peek(ps, es, ";")) { // 根据 ';' 分成多行
+    if (!syntax_error && peek(ps, es, ";")) { // 根据 ';' 分成多行
         get_token(ps, es, 0, 0);
         cmd = build_list_cmd(cmd, parse_line(ps, es)); // 命令链, 递归的解析
     }
@@ -370,7 +526,7 @@ struct cmd* parse_line(char** ps, char* es)
 struct cmd* parse_pipe(char** ps, char* es)
 {
     struct cmd* cmd = parse_exec(ps, es);
-    if (peek(ps, es, "|")) {
+    if (!syntax_error && peek(ps, es, "|")) {
         get_token(ps, es, 0, 0); //
         // 递归的看, 是不是有多个 pipe, 链式传递
         cmd = build_pipe_cmd(cmd, parse_pipe(ps, es));
@@ -384,7 +540,8 @@ struct cmd* parse_redirs(struct cmd* cmd, char** ps, char* es)
         int tok = get_token(ps, es, 0, 0);
         char *q, *eq;
         if (get_token(ps, es, &q, &eq) != 'a') {
-            panic("missing file for redirection");
+            syntax("missing file for redirection");
+            break;
         }
         switch (tok) {
         case '<':
@@ -409,7 +566,8 @@ struct cmd* parse_block(char** ps, char* es)
     get_token(ps, es, 0, 0);
     struct cmd* cmd = parse_line(ps, es);
     if (!peek(ps, es, ")")) {
-        panic("syntax - missing )");
+        syntax("syntax - missing )");
+        return cmd;
     }
     get_token(ps, es, 0, 0);
     cmd = parse_redirs(cmd, ps, es);
@@ -425,21 +583,23 @@ struct cmd* parse_exec(char** ps, char* es)
     ret = parse_redirs(ret, ps, es);
     struct exec_cmd* cmd = (struct exec_cmd*)ret;
     int argc = 0;
-    while (!peek(ps, es, "|)&;")) {
+    while (!syntax_error && !peek(ps, es, "|)&;")) {
         int tok;
         char *q, *eq;
         if ((tok = get_token(ps, es, &q, &eq)) == 0) {
             break;
         }
         if (tok != 'a') {
-            panic("syntax");
+            syntax("syntax");
+            break;
+        }
+        if (argc >= MAXARGS - 1) {
+            syntax("too many args");
+            break;
         }
         cmd->argv[argc] = q;
         cmd->eargv[argc] = eq;
         argc++;
-        if (argc >= MAXARGS) {
-            panic("too many args");
-        }
         ret = parse_redirs(ret, ps, es);
     }
     cmd->argv[argc] = 0;
@@ -447,6 +607,35 @@ struct cmd* parse_exec(char** ps, char* es)
     return ret;
 }
 
+// Free the nodes of cmd, once it has run.
+void free_cmd(struct cmd* cmd)
+{
+    if (cmd == 0) {
+        return;
+    }
+
+    switch (cmd->type) {
+    case REDIR:
+        free_cmd(((struct redir_cmd*)cmd)->cmd);
+        break;
+
+    case PIPE:
+        free_cmd(((struct pipe_cmd*)cmd)->left);
+        free_cmd(((struct pipe_cmd*)cmd)->right);
+        break;
+
+    case LIST:
+        free_cmd(((struct list_cmd*)cmd)->left);
+        free_cmd(((struct list_cmd*)cmd)->right);
+        break;
+
+    case BACK:
+        free_cmd(((struct back_cmd*)cmd)->cmd);
+        break;
+    }
+    free(cmd);
+}
+
 /* ---------- ---------- 命令行解析 ---------- ---------- */
 
 /**
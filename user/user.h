@@ -1,4 +1,6 @@
 struct stat;
+struct memstat;
+struct pstat;
 
 // system calls
 int fork(void);
@@ -22,6 +24,14 @@ int getpid(void);
 char* sbrk(int);
 int sleep(int);
 int uptime(void);
+int memstat(struct memstat*);
+void* mmap(void*, uint64_t, int, int, int, int);
+int munmap(void*, uint64_t);
+int shmget(int, uint64_t);
+int pstat(struct pstat*, int);
+int spawn(const char*, char**, int*);
+int setpriority(int, int);
+int getpriority(int, int*);
 
 // ulib.c
 int stat(const char*, struct stat*);
@@ -7,6 +7,10 @@
 #include "kernel/syscall.h"
 #include "kernel/memlayout.h"
 #include "kernel/riscv.h"
+#include "kernel/memstat.h"
+#include "kernel/pstat.h"
+#include "kernel/mman.h"
+#include "kernel/elf.h"
 
 //
 // Tests xv6 system calls.  usertests without arguments runs them all
@@ -715,6 +719,188 @@ void exectest(char* s)
     }
 }
 
+// spawn() gives the child just the descriptors it was asked
+// to: cat sees the end of its input only if it didn't also get
+// the write side of the pipe.
+void spawntest(char* s)
+{
+    char* catargv[] = { "cat", 0 };
+    int in[2], out[2], fds[3], xstatus, pid;
+    char buf[8];
+
+    fds[0] = 0;
+    fds[1] = 99;
+    fds[2] = 2;
+    if (spawn("cat", catargv, fds) >= 0 || spawn("nonexistent", catargv, 0) >= 0) {
+        printf("%s: bad spawn succeeded\n", s);
+        exit(1);
+    }
+
+    if (pipe(in) < 0 || pipe(out) < 0) {
+        printf("%s: pipe failed\n", s);
+        exit(1);
+    }
+    fds[0] = in[0];
+    fds[1] = out[1];
+    fds[2] = -1;
+    if ((pid = spawn("cat", catargv, fds)) < 0) {
+        printf("%s: spawn failed\n", s);
+        exit(1);
+    }
+    close(in[0]);
+    close(out[1]);
+    if (write(in[1], "spawn", 5) != 5) {
+        printf("%s: write failed\n", s);
+        exit(1);
+    }
+    close(in[1]);
+    int n = 0, m;
+    while ((m = read(out[0], buf + n, sizeof(buf) - n)) > 0)
+        n += m;
+    close(out[0]);
+    if (wait(&xstatus) != pid || xstatus != 0) {
+        printf("%s: wait failed\n", s);
+        exit(1);
+    }
+    if (n != 5 || memcmp(buf, "spawn", 5) != 0) {
+        printf("%s: wrong output\n", s);
+        exit(1);
+    }
+}
+
+// sh runs a list in a pipeline that writes more than a pipe
+// holds: the stage after the list has to be started before the
+// list finishes, or the list fills the pipe and waits forever.
+void shlistpipe(char* s)
+{
+    enum { N = 2000 };
+    char* shargv[] = { "sh", 0 };
+    char* cmd = "(cat shlistin; cat shlistin) | cat > shlistout\n";
+    static char buf[N];
+    struct stat st;
+    int in[2], fds[3], fd, xstatus;
+
+    memset(buf, 'x', N);
+    fd = open("shlistin", O_CREATE | O_WRONLY);
+    if (fd < 0 || write(fd, buf, N) != N) {
+        printf("%s: create failed\n", s);
+        exit(1);
+    }
+    close(fd);
+    // sh's prompts go to a file, not the console.
+    if ((fd = open("shlisterr", O_CREATE | O_WRONLY)) < 0 || pipe(in) < 0) {
+        printf("%s: open failed\n", s);
+        exit(1);
+    }
+    fds[0] = in[0];
+    fds[1] = fd;
+    fds[2] = fd;
+    if (spawn("sh", shargv, fds) < 0) {
+        printf("%s: spawn failed\n", s);
+        exit(1);
+    }
+    close(in[0]);
+    close(fd);
+    if (write(in[1], cmd, strlen(cmd)) != strlen(cmd)) {
+        printf("%s: write failed\n", s);
+        exit(1);
+    }
+    close(in[1]); // sh exits at EOF
+    wait(&xstatus);
+    if (xstatus != 0 || stat("shlistout", &st) < 0 || st.size != 2 * N) {
+        printf("%s: wrong output\n", s);
+        exit(1);
+    }
+    unlink("shlistin");
+    unlink("shlistout");
+    unlink("shlisterr");
+}
+
+// fork, exec path quietly in the child, and return its exit status.
+int execstatus(char* s, char* path)
+{
+    char* argv[] = { path, "x", 0 };
+    int pid, xstatus;
+
+    pid = fork();
+    if (pid < 0) {
+        printf("%s: fork failed\n", s);
+        exit(1);
+    }
+    if (pid == 0) {
+        close(1);
+        exec(path, argv);
+        exit(-2);
+    }
+    wait(&xstatus);
+    return xstatus;
+}
+
+// exec() maps program text from a cache of file pages that
+// outlives the process. rewriting the program must drop those
+// pages, or the next exec() runs the old code.
+void execpcache(char* s)
+{
+    struct stat st;
+    struct elfhdr elf;
+    struct proghdr ph;
+    char* buf;
+    int fd, i;
+
+    // make a private copy of echo.
+    fd = open("echo", O_RDONLY);
+    if (fd < 0 || fstat(fd, &st) < 0) {
+        printf("%s: open echo failed\n", s);
+        exit(1);
+    }
+    buf = sbrk(st.size);
+    if (read(fd, buf, st.size) != st.size) {
+        printf("%s: read echo failed\n", s);
+        exit(1);
+    }
+    close(fd);
+    unlink("pcecho");
+    fd = open("pcecho", O_CREATE | O_WRONLY);
+    if (fd < 0 || write(fd, buf, st.size) != st.size) {
+        printf("%s: write pcecho failed\n", s);
+        exit(1);
+    }
+    close(fd);
+
+    // run it, which leaves its text cached.
+    if (execstatus(s, "pcecho") != 0) {
+        printf("%s: pcecho failed\n", s);
+        exit(1);
+    }
+
+    // zero its text in place, keeping the headers intact.
+    memmove(&elf, buf, sizeof(elf));
+    for (i = 0; i < elf.phnum; i++) {
+        memmove(&ph, buf + elf.phoff + i * sizeof(ph), sizeof(ph));
+        if (ph.type == ELF_PROG_LOAD && (ph.flags & ELF_PROG_FLAG_EXEC)) {
+            uint64_t lo = ph.off;
+            if (lo < elf.phoff + elf.phnum * sizeof(ph))
+                lo = elf.phoff + elf.phnum * sizeof(ph);
+            memset(buf + lo, 0, ph.off + ph.filesz - lo);
+        }
+    }
+    fd = open("pcecho", O_WRONLY);
+    if (fd < 0 || write(fd, buf, st.size) != st.size) {
+        printf("%s: rewrite pcecho failed\n", s);
+        exit(1);
+    }
+    close(fd);
+
+    // all-zero instructions are illegal: it must be killed.
+    if (execstatus(s, "pcecho") != -1) {
+        printf("%s: pcecho ran stale text\n", s);
+        exit(1);
+    }
+
+    unlink("pcecho");
+    sbrk(-st.size);
+}
+
 // simple fork and pipe read/write
 
 void pipe1(char* s)
@@ -2123,6 +2309,64 @@ void MAXVAplus(char* s)
     }
 }
 
+// user code can't run code on the heap, touched or not, or on
+// the stack: the fetch fault kills the process.
+void noexec(char* s)
+{
+    for (int i = 0; i < 3; i++) {
+        int pid = fork();
+        if (pid < 0) {
+            printf("%s: fork failed\n", s);
+            exit(1);
+        }
+        if (pid == 0) {
+            volatile uint_t stack[1];
+            uint_t* code;
+            if (i == 0) {
+                code = (uint_t*)sbrk(PGSIZE);
+                code[0] = 0x00008067; // ret
+            } else if (i == 1) {
+                code = (uint_t*)sbrk(PGSIZE); // never touched
+            } else {
+                stack[0] = 0x00008067;
+                code = (uint_t*)stack;
+            }
+            ((void (*)(void))code)();
+            printf("%s: oops ran code at %p\n", s, code);
+            exit(1);
+        }
+        int xstatus;
+        wait(&xstatus);
+        if (xstatus != -1) { // did kernel kill child?
+            printf("%s: case %d not killed\n", s, i);
+            exit(1);
+        }
+    }
+}
+
+// the vector unit is off in user mode, whether or not the hart
+// has one (the kernel's vector loops don't save the registers):
+// a vector instruction kills the process.
+void novector(char* s)
+{
+    int pid = fork();
+    if (pid < 0) {
+        printf("%s: fork failed\n", s);
+        exit(1);
+    }
+    if (pid == 0) {
+        asm volatile(".word 0x000072d7" : : : "t0"); // vsetvli t0, zero, e8, m1
+        printf("%s: oops ran a vector instruction\n", s);
+        exit(1);
+    }
+    int xstatus;
+    wait(&xstatus);
+    if (xstatus != -1) {
+        printf("%s: not killed\n", s);
+        exit(1);
+    }
+}
+
 // if we run the system out of memory, does it clean up the last
 // failed allocation?
 void sbrkfail(char* s)
@@ -2525,138 +2769,908 @@ void badarg(char* s)
     exit(0);
 }
 
-struct test {
-    void (*f)(char*);
-    char* s;
-} quicktests[] = {
-    { copyin, "copyin" },
-    { copyout, "copyout" },
-    { copyinstr1, "copyinstr1" },
-    { copyinstr2, "copyinstr2" },
-    { copyinstr3, "copyinstr3" },
-    { rwsbrk, "rwsbrk" },
-    { truncate1, "truncate1" },
-    { truncate2, "truncate2" },
-    { truncate3, "truncate3" },
-    { openiputtest, "openiput" },
-    { exitiputtest, "exitiput" },
-    { iputtest, "iput" },
-    { opentest, "opentest" },
-    { writetest, "writetest" },
-    { writebig, "writebig" },
-    { createtest, "createtest" },
-    { dirtest, "dirtest" },
-    { exectest, "exectest" },
-    { pipe1, "pipe1" },
-    { killstatus, "killstatus" },
-    { preempt, "preempt" },
-    { exitwait, "exitwait" },
-    { reparent, "reparent" },
-    { twochildren, "twochildren" },
-    { forkfork, "forkfork" },
-    { forkforkfork, "forkforkfork" },
-    { reparent2, "reparent2" },
-    { mem, "mem" },
-    { sharedfd, "sharedfd" },
-    { fourfiles, "fourfiles" },
-    { createdelete, "createdelete" },
-    { unlinkread, "unlinkread" },
-    { linktest, "linktest" },
-    { concreate, "concreate" },
-    { linkunlink, "linkunlink" },
-    { subdir, "subdir" },
-    { bigwrite, "bigwrite" },
-    { bigfile, "bigfile" },
-    { fourteen, "fourteen" },
-    { rmdot, "rmdot" },
-    { dirfile, "dirfile" },
-    { iref, "iref" },
-    { forktest, "forktest" },
-    { sbrkbasic, "sbrkbasic" },
-    { sbrkmuch, "sbrkmuch" },
-    { kernmem, "kernmem" },
-    { MAXVAplus, "MAXVAplus" },
-    { sbrkfail, "sbrkfail" },
-    { sbrkarg, "sbrkarg" },
-    { validatetest, "validatetest" },
-    { bsstest, "bsstest" },
-    { bigargtest, "bigargtest" },
-    { argptest, "argptest" },
-    { stacktest, "stacktest" },
-    { nowrite, "nowrite" },
-    { pgbug, "pgbug" },
-    { sbrkbugs, "sbrkbugs" },
-    { sbrklast, "sbrklast" },
-    { sbrk8000, "sbrk8000" },
-    { badarg, "badarg" },
-
-    { 0, 0 },
-};
-
-//
-// Section with tests that take a fair bit of time
-//
+int countfree();
 
-// directory that uses indirect blocks
-void bigdir(char* s)
+// copy-on-write fork: parent and child must each see
+// their own writes and not the other's, and a fork of
+// a process using more than half of free memory must
+// still succeed since nothing is copied up front.
+void cowtest(char* s)
 {
-    enum { N = 500 };
-    int i, fd;
-    char name[10];
-
-    unlink("bd");
-
-    fd = open("bd", O_CREATE);
-    if (fd < 0) {
-        printf("%s: bigdir create failed\n", s);
+    uint64_t sz = (uint64_t)countfree() * 4096 * 2 / 3;
+    char* a = sbrk(sz);
+    if (a == (char*)-1) {
+        printf("%s: sbrk(%ld) failed\n", s, sz);
         exit(1);
     }
-    close(fd);
+    for (uint64_t i = 0; i < sz; i += 4096)
+        a[i] = 'p';
 
-    for (i = 0; i < N; i++) {
-        name[0] = 'x';
-        name[1] = '0' + (i / 64);
-        name[2] = '0' + (i % 64);
-        name[3] = '\0';
-        if (link("bd", name) != 0) {
-            printf("%s: bigdir i=%d link(bd, %s) failed\n", s, i, name);
+    int pid = fork();
+    if (pid < 0) {
+        printf("%s: fork failed\n", s);
+        exit(1);
+    }
+    if (pid == 0) {
+        // touch a few pages, not all: there isn't
+        // enough memory for a full copy.
+        for (uint64_t i = 0; i < sz; i += 64 * 4096) {
+            if (a[i] != 'p') {
+                printf("%s: child saw wrong data\n", s);
+                exit(1);
+            }
+            a[i] = 'c';
+        }
+        exit(0);
+    }
+    int xstatus;
+    wait(&xstatus);
+    if (xstatus != 0)
+        exit(xstatus);
+    for (uint64_t i = 0; i < sz; i += 4096) {
+        if (a[i] != 'p') {
+            printf("%s: parent saw child's write\n", s);
             exit(1);
         }
     }
 
-    unlink("bd");
-    for (i = 0; i < N; i++) {
-        name[0] = 'x';
-        name[1] = '0' + (i / 64);
-        name[2] = '0' + (i % 64);
-        name[3] = '\0';
-        if (unlink(name) != 0) {
-            printf("%s: bigdir unlink failed", s);
+    // the kernel must break sharing when it writes to user memory too.
+    int fds[2];
+    if (pipe(fds) < 0) {
+        printf("%s: pipe failed\n", s);
+        exit(1);
+    }
+    pid = fork();
+    if (pid == 0) {
+        if (read(fds[0], a, 1) != 1 || a[0] != 'x')
             exit(1);
-        }
+        exit(0);
+    }
+    write(fds[1], "x", 1);
+    wait(&xstatus);
+    if (xstatus != 0 || a[0] != 'p') {
+        printf("%s: copyout into a shared page leaked\n", s);
+        exit(1);
     }
+    close(fds[0]);
+    close(fds[1]);
+    sbrk(-sz);
 }
 
-// concurrent writes to try to provoke deadlock in the virtio disk
-// driver.
-void manywrites(char* s)
+// sbrk() should only reserve address space; pages appear
+// when first touched, by the program or by the kernel.
+void lazysbrk(char* s)
 {
-    int nchildren = 4;
-    int howmany = 30; // increase to look for deadlock
+    enum { BIG = 64 * 1024 * 1024 };
+    struct memstat st0, st1;
 
-    for (int ci = 0; ci < nchildren; ci++) {
-        int pid = fork();
-        if (pid < 0) {
-            printf("fork failed\n");
-            exit(1);
-        }
+    memstat(&st0);
+    char* a = sbrk(BIG);
+    if (a == (char*)-1) {
+        printf("%s: sbrk failed\n", s);
+        exit(1);
+    }
+    memstat(&st1);
+    if (st0.nfree - st1.nfree > 16) {
+        printf("%s: sbrk allocated %ld pages up front\n", s, st0.nfree - st1.nfree);
+        exit(1);
+    }
 
-        if (pid == 0) {
-            char name[3];
-            name[0] = 'b';
-            name[1] = 'a' + ci;
-            name[2] = '\0';
-            unlink(name);
+    // untouched pages read as zero.
+    if (a[0] != 0 || a[BIG - 1] != 0) {
+        printf("%s: lazy page not zero\n", s);
+        exit(1);
+    }
+
+    // the kernel faults pages in for copyout/copyin too.
+    int fds[2];
+    if (pipe(fds) < 0) {
+        printf("%s: pipe failed\n", s);
+        exit(1);
+    }
+    char* mid = a + BIG / 2;
+    if (write(fds[1], "lazy", 4) != 4 || read(fds[0], mid, 4) != 4 || mid[0] != 'l') {
+        printf("%s: copyout to a lazy page failed\n", s);
+        exit(1);
+    }
+    if (write(fds[1], mid + PGSIZE, 2) != 2) {
+        printf("%s: copyin from a lazy page failed\n", s);
+        exit(1);
+    }
+    close(fds[0]);
+    close(fds[1]);
+
+    // fork copies only what has been touched.
+    int pid = fork();
+    if (pid == 0) {
+        exit(mid[0] == 'l' && mid[3 * PGSIZE] == 0 ? 0 : 1);
+    }
+    int xstatus;
+    wait(&xstatus);
+    if (xstatus != 0) {
+        printf("%s: child saw wrong heap\n", s);
+        exit(1);
+    }
+
+    sbrk(-BIG);
+}
+
+// the kernel maps aligned 2 MiB stretches of a big heap with
+// megapages. shrinking into the middle of one, and fork, have
+// to split them into 4 KiB pages without losing anything.
+void megaheap(char* s)
+{
+    enum { MEGA = 512 * PGSIZE,
+        BIG = 8 * 1024 * 1024 };
+    struct memstat st0, st1;
+    int i, pid, xstatus;
+
+    char* a = sbrk(BIG);
+    if (a == (char*)-1) {
+        printf("%s: sbrk failed\n", s);
+        exit(1);
+    }
+    char* m = (char*)(((uint64_t)a + MEGA - 1) & ~(uint64_t)(MEGA - 1));
+
+    // one touch brings in the whole megapage.
+    memstat(&st0);
+    m[0] = 1;
+    memstat(&st1);
+    if (st0.nfree - st1.nfree < 512) {
+        printf("%s: no megapage (%ld pages)\n", s, st0.nfree - st1.nfree);
+        exit(1);
+    }
+
+    for (i = 0; i < 1024; i++)
+        *(int*)(m + i * PGSIZE) = i;
+
+    // cut the second megapage in half.
+    char* end = sbrk(0);
+    if (sbrk(-(end - (m + MEGA + MEGA / 2))) == (char*)-1) {
+        printf("%s: shrink failed\n", s);
+        exit(1);
+    }
+    for (i = 0; i < 768; i++) {
+        if (*(int*)(m + i * PGSIZE) != i) {
+            printf("%s: page %d lost by shrink\n", s, i);
+            exit(1);
+        }
+    }
+    sbrk(MEGA);
+    if (*(int*)(m + 900 * PGSIZE) != 0) {
+        printf("%s: regrown page not zero\n", s);
+        exit(1);
+    }
+
+    // the child shares the first megapage copy-on-write.
+    pid = fork();
+    if (pid < 0) {
+        printf("%s: fork failed\n", s);
+        exit(1);
+    }
+    if (pid == 0) {
+        for (i = 0; i < 512; i++) {
+            if (*(int*)(m + i * PGSIZE) != i)
+                exit(1);
+        }
+        *(int*)m = -1;
+        *(int*)(m + 300 * PGSIZE) = -1;
+        exit(0);
+    }
+    wait(&xstatus);
+    if (xstatus != 0) {
+        printf("%s: child saw wrong heap\n", s);
+        exit(1);
+    }
+    if (*(int*)m != 0 || *(int*)(m + 300 * PGSIZE) != 300) {
+        printf("%s: child's writes leaked into parent\n", s);
+        exit(1);
+    }
+
+    sbrk(-((char*)sbrk(0) - a));
+}
+
+// anonymous mmap(): private and shared memory across fork(),
+// and munmap() of part of a region.
+void mmapanon(char* s)
+{
+    enum { N = 8 };
+    int i, pid, xstatus;
+
+    char* priv = mmap(0, N * PGSIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    char* shr = mmap(0, N * PGSIZE, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (priv == MAP_FAILED || shr == MAP_FAILED) {
+        printf("%s: mmap failed\n", s);
+        exit(1);
+    }
+    if (priv < (char*)sbrk(0) || shr < (char*)sbrk(0) || (priv < shr + N * PGSIZE && shr < priv + N * PGSIZE)) {
+        printf("%s: bad placement %p %p\n", s, priv, shr);
+        exit(1);
+    }
+    for (i = 0; i < N; i++) {
+        if (priv[i * PGSIZE] != 0 || shr[i * PGSIZE] != 0) {
+            printf("%s: not zeroed\n", s);
+            exit(1);
+        }
+        priv[i * PGSIZE] = i;
+    }
+
+    // the child's stores reach the parent only through shr.
+    pid = fork();
+    if (pid < 0) {
+        printf("%s: fork failed\n", s);
+        exit(1);
+    }
+    if (pid == 0) {
+        for (i = 0; i < N; i++) {
+            if (priv[i * PGSIZE] != i)
+                exit(1);
+            priv[i * PGSIZE] = -1;
+            shr[i * PGSIZE] = i + 1;
+        }
+        exit(0);
+    }
+    wait(&xstatus);
+    if (xstatus != 0) {
+        printf("%s: child saw wrong memory\n", s);
+        exit(1);
+    }
+    for (i = 0; i < N; i++) {
+        if (priv[i * PGSIZE] != i || shr[i * PGSIZE] != i + 1) {
+            printf("%s: page %d: private %d shared %d\n", s, i, priv[i * PGSIZE], shr[i * PGSIZE]);
+            exit(1);
+        }
+    }
+
+    // punch a hole in the middle; both sides stay.
+    if (munmap(priv + 2 * PGSIZE, 3 * PGSIZE) != 0) {
+        printf("%s: munmap failed\n", s);
+        exit(1);
+    }
+    if (priv[PGSIZE] != 1 || priv[6 * PGSIZE] != 6) {
+        printf("%s: munmap took too much\n", s);
+        exit(1);
+    }
+    pid = fork();
+    if (pid < 0) {
+        printf("%s: fork failed\n", s);
+        exit(1);
+    }
+    if (pid == 0) {
+        priv[3 * PGSIZE] = 1; // should be killed
+        exit(0);
+    }
+    wait(&xstatus);
+    if (xstatus != -1) {
+        printf("%s: unmapped page still there\n", s);
+        exit(1);
+    }
+
+    if (munmap(priv, N * PGSIZE) != 0 || munmap(shr, N * PGSIZE) != 0) {
+        printf("%s: munmap failed\n", s);
+        exit(1);
+    }
+    if (mmap(0, PGSIZE, 0, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0) != MAP_FAILED) {
+        printf("%s: mmap without PROT_READ\n", s);
+        exit(1);
+    }
+}
+
+// file mmap(): the mapping reads like read(), private stores
+// stay private, and shared stores reach the file on munmap()
+// and on exit().
+void mmapfile(char* s)
+{
+    enum { N = 5 };
+    char buf[64];
+    int fd, i, pid, xstatus;
+    char* a;
+
+    unlink("mmapfile");
+    fd = open("mmapfile", O_CREATE | O_RDWR);
+    if (fd < 0) {
+        printf("%s: create failed\n", s);
+        exit(1);
+    }
+    for (i = 0; i < N * PGSIZE / (int)sizeof(buf); i++) {
+        memset(buf, 'a' + i % 26, sizeof(buf));
+        if (write(fd, buf, sizeof(buf)) != sizeof(buf)) {
+            printf("%s: write failed\n", s);
+            exit(1);
+        }
+    }
+
+    // a mapping may run past the end of the file: zeroes.
+    a = mmap(0, (N + 1) * PGSIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+    if (a == MAP_FAILED) {
+        printf("%s: mmap private failed\n", s);
+        exit(1);
+    }
+    for (i = 0; i < N * PGSIZE; i += sizeof(buf)) {
+        if (a[i] != 'a' + i / (int)sizeof(buf) % 26) {
+            printf("%s: wrong data at %d\n", s, i);
+            exit(1);
+        }
+    }
+    if (a[N * PGSIZE] != 0) {
+        printf("%s: no zeroes past the end\n", s);
+        exit(1);
+    }
+    a[0] = 'X';
+    munmap(a, (N + 1) * PGSIZE);
+
+    // from an offset into the file.
+    a = mmap(0, N * PGSIZE, PROT_READ, MAP_SHARED, fd, PGSIZE);
+    if (a == MAP_FAILED) {
+        printf("%s: mmap at offset failed\n", s);
+        exit(1);
+    }
+    if (a[0] != 'a' + PGSIZE / (int)sizeof(buf) % 26) {
+        printf("%s: wrong data at offset\n", s);
+        exit(1);
+    }
+    munmap(a, N * PGSIZE);
+
+    a = mmap(0, N * PGSIZE, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (a == MAP_FAILED) {
+        printf("%s: mmap shared failed\n", s);
+        exit(1);
+    }
+    if (a[0] != 'a') {
+        printf("%s: private store reached the file\n", s);
+        exit(1);
+    }
+    a[1] = 'Y';
+    munmap(a, N * PGSIZE);
+
+    // a child that exits with the file mapped.
+    pid = fork();
+    if (pid < 0) {
+        printf("%s: fork failed\n", s);
+        exit(1);
+    }
+    if (pid == 0) {
+        a = mmap(0, N * PGSIZE, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        if (a == MAP_FAILED)
+            exit(1);
+        a[3 * PGSIZE] = 'Z';
+        exit(0);
+    }
+    wait(&xstatus);
+    if (xstatus != 0) {
+        printf("%s: child failed\n", s);
+        exit(1);
+    }
+    close(fd);
+
+    fd = open("mmapfile", O_RDONLY);
+    if (fd < 0 || read(fd, buf, 2) != 2 || buf[0] != 'a' || buf[1] != 'Y') {
+        printf("%s: munmap didn't write back\n", s);
+        exit(1);
+    }
+    if (mmap(0, PGSIZE, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0) != MAP_FAILED) {
+        printf("%s: writable shared mapping of a read-only fd\n", s);
+        exit(1);
+    }
+    a = mmap(0, N * PGSIZE, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (a == MAP_FAILED || a[3 * PGSIZE] != 'Z') {
+        printf("%s: exit didn't write back\n", s);
+        exit(1);
+    }
+    munmap(a, N * PGSIZE);
+    close(fd);
+    unlink("mmapfile");
+}
+
+// write() to a file that is mapped MAP_PRIVATE: the mapping
+// keeps the data it first saw, and read() sees the new data.
+void mmapwrite(char* s)
+{
+    char buf[PGSIZE / 4];
+    int fd;
+    char* a;
+
+    unlink("mmapwrite");
+    fd = open("mmapwrite", O_CREATE | O_RDWR);
+    memset(buf, 'a', sizeof(buf));
+    for (int i = 0; i < 4; i++) {
+        if (write(fd, buf, sizeof(buf)) != sizeof(buf)) {
+            printf("%s: write failed\n", s);
+            exit(1);
+        }
+    }
+    close(fd);
+
+    fd = open("mmapwrite", O_RDWR);
+    a = mmap(0, PGSIZE, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (a == MAP_FAILED) {
+        printf("%s: mmap failed\n", s);
+        exit(1);
+    }
+    if (a[0] != 'a') { // mapped from the page cache now
+        printf("%s: wrong data\n", s);
+        exit(1);
+    }
+    if (write(fd, "b", 1) != 1) {
+        printf("%s: write failed\n", s);
+        exit(1);
+    }
+    if (a[0] != 'a') {
+        printf("%s: write() reached a private mapping\n", s);
+        exit(1);
+    }
+    close(fd);
+
+    fd = open("mmapwrite", O_RDONLY);
+    if (read(fd, buf, 2) != 2 || buf[0] != 'b' || buf[1] != 'a') {
+        printf("%s: read() missed the write\n", s);
+        exit(1);
+    }
+    close(fd);
+    munmap(a, PGSIZE);
+    unlink("mmapwrite");
+}
+
+// shmget(): a segment found by key from an unrelated mapping
+// shares its pages, and goes away with its last reference.
+void shmtest(char* s)
+{
+    enum { N = 16, KEY = 0x5eed };
+    struct memstat st0, st1;
+    int fd, i, pid, xstatus;
+    char buf[8];
+
+    memstat(&st0);
+    fd = shmget(KEY, N * PGSIZE);
+    if (fd < 0) {
+        printf("%s: shmget failed\n", s);
+        exit(1);
+    }
+    if (shmget(KEY, (N + 1) * PGSIZE) >= 0) {
+        printf("%s: segment grew\n", s);
+        exit(1);
+    }
+    if (read(fd, buf, sizeof(buf)) >= 0 || mmap(0, PGSIZE, PROT_READ, MAP_PRIVATE, fd, 0) != MAP_FAILED
+        || mmap(0, 2 * PGSIZE, PROT_READ, MAP_SHARED, fd, (N - 1) * PGSIZE) != MAP_FAILED) {
+        printf("%s: bad use of segment allowed\n", s);
+        exit(1);
+    }
+    char* a = mmap(0, N * PGSIZE, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (a == MAP_FAILED) {
+        printf("%s: mmap failed\n", s);
+        exit(1);
+    }
+    close(fd); // the mapping keeps the segment
+    a[0] = 'p';
+
+    pid = fork();
+    if (pid < 0) {
+        printf("%s: fork failed\n", s);
+        exit(1);
+    }
+    if (pid == 0) {
+        // give up the inherited mapping and find the segment
+        // by key, as an unrelated process would.
+        munmap(a, N * PGSIZE);
+        if ((fd = shmget(KEY, PGSIZE)) < 0)
+            exit(1);
+        char* b = mmap(0, N * PGSIZE, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        if (b == MAP_FAILED || b[0] != 'p' || b[PGSIZE] != 0)
+            exit(1);
+        for (i = 0; i < N; i++)
+            b[i * PGSIZE + 1] = i;
+        exit(0);
+    }
+    wait(&xstatus);
+    if (xstatus != 0) {
+        printf("%s: child failed\n", s);
+        exit(1);
+    }
+    for (i = 0; i < N; i++) {
+        if (a[i * PGSIZE + 1] != i) {
+            printf("%s: page %d not shared\n", s, i);
+            exit(1);
+        }
+    }
+
+    munmap(a, N * PGSIZE);
+    memstat(&st1);
+    if (st1.nfree + 4 < st0.nfree) {
+        printf("%s: %ld pages not freed\n", s, st0.nfree - st1.nfree);
+        exit(1);
+    }
+    fd = shmget(KEY, PGSIZE);
+    a = mmap(0, PGSIZE, PROT_READ, MAP_SHARED, fd, 0);
+    if (a == MAP_FAILED || a[0] != 0) {
+        printf("%s: old segment still there\n", s);
+        exit(1);
+    }
+    munmap(a, PGSIZE);
+    close(fd);
+}
+
+// setpriority() clamps, and fork() passes the nice value on.
+void nicetest(char* s)
+{
+    int nice, xstatus;
+
+    if (getpriority(0, &nice) < 0 || nice != 0) {
+        printf("%s: not nice 0 to start with\n", s);
+        exit(1);
+    }
+    if (setpriority(0, 100) < 0 || getpriority(getpid(), &nice) < 0 || nice != NICE_MAX) {
+        printf("%s: nice not clamped\n", s);
+        exit(1);
+    }
+    if (setpriority(-1, 0) >= 0 || getpriority(-1, &nice) >= 0) {
+        printf("%s: no such process, but it worked\n", s);
+        exit(1);
+    }
+    int pid = fork();
+    if (pid < 0) {
+        printf("%s: fork failed\n", s);
+        exit(1);
+    }
+    if (pid == 0)
+        exit(getpriority(0, &nice) < 0 || nice != NICE_MAX);
+    wait(&xstatus);
+    setpriority(0, 0);
+    if (xstatus != 0) {
+        printf("%s: child didn't inherit nice\n", s);
+        exit(1);
+    }
+}
+
+// sleep(n) takes n ticks, by uptime() and by the time CSR, even
+// though a machine with nothing to run skips its timer ticks.
+void sleeptime(char* s)
+{
+    for (int n = 1; n <= 5; n += 2) {
+        uint64_t c0, c1;
+        int t0 = uptime();
+        asm volatile("rdtime %0" : "=r"(c0));
+        sleep(n);
+        asm volatile("rdtime %0" : "=r"(c1));
+        int t1 = uptime();
+        // sleep() counts from partway through the current tick.
+        if (t1 - t0 < n || c1 - c0 < (uint64_t)(n - 1) * TICK) {
+            printf("%s: sleep(%d) woke too soon\n", s, n);
+            exit(1);
+        }
+        if (t1 - t0 > n + 1 || c1 - c0 > (uint64_t)(n + 1) * TICK) {
+            printf("%s: sleep(%d) took %d ticks\n", s, n, t1 - t0);
+            exit(1);
+        }
+    }
+}
+
+// one write() wakes several children at once, all queued on the
+// writer's hart, which then kicks idle harts (with CPUS > 1) to
+// take them; the children spin a while, then report back.
+void wakefanout(char* s)
+{
+    enum { N = 4 };
+    int in[2], out[2], i, xstatus;
+    char buf[N];
+
+    if (pipe(in) < 0 || pipe(out) < 0) {
+        printf("%s: pipe failed\n", s);
+        exit(1);
+    }
+    for (int round = 0; round < 10; round++) {
+        for (i = 0; i < N; i++) {
+            int pid = fork();
+            if (pid < 0) {
+                printf("%s: fork failed\n", s);
+                exit(1);
+            }
+            if (pid == 0) {
+                char c;
+                if (read(in[0], &c, 1) != 1)
+                    exit(1);
+                for (volatile int j = 0; j < 1000000; j++)
+                    ;
+                exit(write(out[1], &c, 1) == 1 ? 0 : 1);
+            }
+        }
+        sleep(1); // let them all block in read()
+        memset(buf, 'k', N);
+        if (write(in[1], buf, N) != N) {
+            printf("%s: write failed\n", s);
+            exit(1);
+        }
+        for (i = 0; i < N; i++) {
+            wait(&xstatus);
+            if (xstatus != 0) {
+                printf("%s: child failed\n", s);
+                exit(1);
+            }
+        }
+        if (read(out[0], buf, N) != N) {
+            printf("%s: lost a wakeup\n", s);
+            exit(1);
+        }
+    }
+    close(in[0]);
+    close(in[1]);
+    close(out[0]);
+    close(out[1]);
+}
+
+// pstat() and memstat() see lazily grown heap pages as this
+// process's and as user memory once touched, and not before.
+void pstattest(char* s)
+{
+    enum { N = 64 };
+    static struct pstat ps[NPROC];
+    struct pstat me0, me1;
+    struct memstat st0, st1;
+    int i, n, found = 0;
+
+    memstat(&st0);
+    char* a = sbrk(N * PGSIZE);
+    if (a == (char*)-1) {
+        printf("%s: sbrk failed\n", s);
+        exit(1);
+    }
+    for (int round = 0; round < 2; round++) {
+        if ((n = pstat(ps, NPROC)) <= 0) {
+            printf("%s: pstat failed\n", s);
+            exit(1);
+        }
+        for (i = 0; i < n && ps[i].pid != getpid(); i++)
+            ;
+        if (i == n || strcmp(ps[i].state, "run   ") != 0) {
+            printf("%s: not in pstat\n", s);
+            exit(1);
+        }
+        if (round == 0) {
+            me0 = ps[i];
+            for (i = 0; i < N; i++)
+                a[i * PGSIZE] = i;
+        } else {
+            me1 = ps[i];
+            found = 1;
+        }
+    }
+    memstat(&st1);
+    if (!found || me1.sz != me0.sz || me0.npt == 0) {
+        printf("%s: bad pstat\n", s);
+        exit(1);
+    }
+    if (me1.rss < me0.rss + N) {
+        printf("%s: rss grew by %ld, not %d\n", s, me1.rss - me0.rss, N);
+        exit(1);
+    }
+    if (st1.nuse[MU_USER] < st0.nuse[MU_USER] + N || st1.nuse[MU_PGTBL] == 0) {
+        printf("%s: user memory not counted\n", s);
+        exit(1);
+    }
+    if (me1.nrun == 0 || me1.runtime <= me0.runtime) {
+        printf("%s: runtime not counted\n", s);
+        exit(1);
+    }
+    sbrk(-N * PGSIZE);
+}
+
+// file data goes through the page cache: a file much bigger
+// than the buffer cache reads back right, stays cached, and
+// write() shows through a shared mapping of it.
+void pcachefile(char* s)
+{
+    enum { N = 128 }; // KiB
+    char buf[BSIZE];
+    struct memstat st0, st1;
+    int fd, i, j;
+
+    unlink("pcachefile");
+    fd = open("pcachefile", O_CREATE | O_RDWR);
+    if (fd < 0) {
+        printf("%s: create failed\n", s);
+        exit(1);
+    }
+    memstat(&st0);
+    for (i = 0; i < N; i++) {
+        memset(buf, i, sizeof(buf));
+        if (write(fd, buf, sizeof(buf)) != sizeof(buf)) {
+            printf("%s: write failed\n", s);
+            exit(1);
+        }
+    }
+    close(fd);
+
+    for (int round = 0; round < 2; round++) {
+        fd = open("pcachefile", O_RDONLY);
+        for (i = 0; i < N; i++) {
+            if (read(fd, buf, sizeof(buf)) != sizeof(buf)) {
+                printf("%s: read failed\n", s);
+                exit(1);
+            }
+            for (j = 0; j < sizeof(buf); j++) {
+                if (buf[j] != (char)i) {
+                    printf("%s: wrong data in KiB %d\n", s, i);
+                    exit(1);
+                }
+            }
+        }
+        close(fd);
+    }
+    memstat(&st1);
+    if (st1.npcache < st0.npcache + N / 4 - 4) {
+        printf("%s: file not cached (%ld pages)\n", s, st1.npcache - st0.npcache);
+        exit(1);
+    }
+
+    fd = open("pcachefile", O_RDWR);
+    char* a = mmap(0, N * 1024, PROT_READ, MAP_SHARED, fd, 0);
+    if (a == MAP_FAILED) {
+        printf("%s: mmap failed\n", s);
+        exit(1);
+    }
+    // fault in page 0 first, so the write() must reach it.
+    if (a[0] != 0 || a[5000] != 4) {
+        printf("%s: wrong data through mapping\n", s);
+        exit(1);
+    }
+    memset(buf, 'W', sizeof(buf));
+    if (write(fd, buf, 10) != 10 || a[0] != 'W' || a[10] != 0) {
+        printf("%s: write() not seen by mapping\n", s);
+        exit(1);
+    }
+    munmap(a, N * 1024);
+    close(fd);
+    unlink("pcachefile");
+}
+
+struct test {
+    void (*f)(char*);
+    char* s;
+} quicktests[] = {
+    { copyin, "copyin" },
+    { copyout, "copyout" },
+    { copyinstr1, "copyinstr1" },
+    { copyinstr2, "copyinstr2" },
+    { copyinstr3, "copyinstr3" },
+    { rwsbrk, "rwsbrk" },
+    { truncate1, "truncate1" },
+    { truncate2, "truncate2" },
+    { truncate3, "truncate3" },
+    { openiputtest, "openiput" },
+    { exitiputtest, "exitiput" },
+    { iputtest, "iput" },
+    { opentest, "opentest" },
+    { writetest, "writetest" },
+    { writebig, "writebig" },
+    { createtest, "createtest" },
+    { dirtest, "dirtest" },
+    { exectest, "exectest" },
+    { spawntest, "spawn" },
+    { shlistpipe, "shlistpipe" },
+    { execpcache, "execpcache" },
+    { pipe1, "pipe1" },
+    { killstatus, "killstatus" },
+    { preempt, "preempt" },
+    { exitwait, "exitwait" },
+    { reparent, "reparent" },
+    { twochildren, "twochildren" },
+    { forkfork, "forkfork" },
+    { forkforkfork, "forkforkfork" },
+    { reparent2, "reparent2" },
+    { mem, "mem" },
+    { sharedfd, "sharedfd" },
+    { fourfiles, "fourfiles" },
+    { createdelete, "createdelete" },
+    { unlinkread, "unlinkread" },
+    { linktest, "linktest" },
+    { concreate, "concreate" },
+    { linkunlink, "linkunlink" },
+    { subdir, "subdir" },
+    { bigwrite, "bigwrite" },
+    { bigfile, "bigfile" },
+    { fourteen, "fourteen" },
+    { rmdot, "rmdot" },
+    { dirfile, "dirfile" },
+    { iref, "iref" },
+    { forktest, "forktest" },
+    { cowtest, "cowtest" },
+    { sbrkbasic, "sbrkbasic" },
+    { sbrkmuch, "sbrkmuch" },
+    { lazysbrk, "lazysbrk" },
+    { megaheap, "megaheap" },
+    { mmapanon, "mmapanon" },
+    { mmapfile, "mmapfile" },
+    { mmapwrite, "mmapwrite" },
+    { pcachefile, "pcachefile" },
+    { shmtest, "shm" },
+    { pstattest, "pstat" },
+    { nicetest, "nice" },
+    { sleeptime, "sleeptime" },
+    { wakefanout, "wakefanout" },
+    { kernmem, "kernmem" },
+    { MAXVAplus, "MAXVAplus" },
+    { noexec, "noexec" },
+    { novector, "novector" },
+    { sbrkfail, "sbrkfail" },
+    { sbrkarg, "sbrkarg" },
+    { validatetest, "validatetest" },
+    { bsstest, "bsstest" },
+    { bigargtest, "bigargtest" },
+    { argptest, "argptest" },
+    { stacktest, "stacktest" },
+    { nowrite, "nowrite" },
+    { pgbug, "pgbug" },
+    { sbrkbugs, "sbrkbugs" },
+    { sbrklast, "sbrklast" },
+    { sbrk8000, "sbrk8000" },
+    { badarg, "badarg" },
+
+    { 0, 0 },
+};
+
+//
+// Section with tests that take a fair bit of time
+//
+
+// directory that uses indirect blocks
+void bigdir(char* s)
+{
+    enum { N = 500 };
+    int i, fd;
+    char name[10];
+
+    unlink("bd");
+
+    fd = open("bd", O_CREATE);
+    if (fd < 0) {
+        printf("%s: bigdir create failed\n", s);
+        exit(1);
+    }
+    close(fd);
+
+    for (i = 0; i < N; i++) {
+        name[0] = 'x';
+        name[1] = '0' + (i / 64);
+        name[2] = '0' + (i % 64);
+        name[3] = '\0';
+        if (link("bd", name) != 0) {
+            printf("%s: bigdir i=%d link(bd, %s) failed\n", s, i, name);
+            exit(1);
+        }
+    }
+
+    unlink("bd");
+    for (i = 0; i < N; i++) {
+        name[0] = 'x';
+        name[1] = '0' + (i / 64);
+        name[2] = '0' + (i % 64);
+        name[3] = '\0';
+        if (unlink(name) != 0) {
+            printf("%s: bigdir unlink failed", s);
+            exit(1);
+        }
+    }
+}
+
+// concurrent writes to try to provoke deadlock in the virtio disk
+// driver.
+void manywrites(char* s)
+{
+    int nchildren = 4;
+    int howmany = 30; // increase to look for deadlock
+
+    for (int ci = 0; ci < nchildren; ci++) {
+        int pid = fork();
+        if (pid < 0) {
+            printf("fork failed\n");
+            exit(1);
+        }
+
+        if (pid == 0) {
+            char name[3];
+            name[0] = 'b';
+            name[1] = 'a' + ci;
+            name[2] = '\0';
+            unlink(name);
 
             for (int iters = 0; iters < howmany; iters++) {
                 for (int i = 0; i < ci + 1; i++) {
@@ -2872,7 +3886,86 @@ void outofinodes(char* s)
     }
 }
 
+// ask for more memory than is free while another process sits
+// in sleep() on a big heap: its pages go out to swap rather than
+// the allocation failing, and come back intact.
+void swaptest(char* s)
+{
+    enum { SLEEPER = 8 * 1024 * 1024 };
+    struct memstat st0, st1;
+    int i, pid, hog, xstatus;
+
+    volatile int* flag = mmap(0, PGSIZE, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (flag == MAP_FAILED) {
+        printf("%s: mmap failed\n", s);
+        exit(1);
+    }
+
+    pid = fork();
+    if (pid < 0) {
+        printf("%s: fork failed\n", s);
+        exit(1);
+    }
+    if (pid == 0) {
+        char* a = sbrk(SLEEPER);
+        if (a == (char*)-1)
+            exit(1);
+        for (i = 0; i < SLEEPER; i += PGSIZE)
+            *(int*)(a + i) = i;
+        flag[0] = 1;
+        while (flag[1] == 0)
+            sleep(1);
+        for (i = 0; i < SLEEPER; i += PGSIZE) {
+            if (*(int*)(a + i) != i)
+                exit(1);
+        }
+        exit(0);
+    }
+    while (flag[0] == 0)
+        sleep(1);
+
+    memstat(&st0);
+    hog = fork();
+    if (hog < 0) {
+        printf("%s: fork failed\n", s);
+        exit(1);
+    }
+    if (hog == 0) {
+        uint64_t n = st0.nfree + st0.npcache + 1024;
+        char* a = sbrk(n * PGSIZE);
+        if (a == (char*)-1)
+            exit(1);
+        for (uint64_t j = 0; j < n; j++)
+            a[j * PGSIZE] = 1;
+        exit(0);
+    }
+    wait(&xstatus);
+    if (xstatus != 0) {
+        printf("%s: big allocation failed\n", s);
+        exit(1);
+    }
+    memstat(&st1);
+    if (st1.nswapout == st0.nswapout) {
+        printf("%s: nothing swapped out\n", s);
+        exit(1);
+    }
+
+    flag[1] = 1;
+    wait(&xstatus);
+    if (xstatus != 0) {
+        printf("%s: sleeper's memory lost\n", s);
+        exit(1);
+    }
+    memstat(&st0);
+    if (st0.nswapin == st1.nswapin || st0.nswapused != 0) {
+        printf("%s: swap-in %ld slots in use %ld\n", s, st0.nswapin - st1.nswapin, st0.nswapused);
+        exit(1);
+    }
+    munmap((void*)flag, PGSIZE);
+}
+
 struct test slowtests[] = {
+    { swaptest, "swap" },
     { bigdir, "bigdir" },
     { manywrites, "manywrites" },
     { badwrite, "badwrite" },
@@ -36,3 +36,11 @@ entry("getpid");
 entry("sbrk");
 entry("sleep");
 entry("uptime");
+entry("memstat");
+entry("mmap");
+entry("munmap");
+entry("shmget");
+entry("pstat");
+entry("spawn");
+entry("setpriority");
+entry("getpriority");